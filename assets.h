@@ -0,0 +1,21 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+/* Raw assets linked in from assets.S. The data lives in .rodata and
+ * every asset starts on a 64-byte boundary. The grids are one byte per
+ * pixel, indexing grid_pal: a little-endian 32-bit entry count followed
+ * by that many XRGB8888 entries. */
+
+extern const unsigned char grid_pal[];
+extern const unsigned int grid_pal_len;
+extern const unsigned char grid_50_idx8[];
+extern const unsigned int grid_50_idx8_len;
+extern const unsigned char grid_60_idx8[];
+extern const unsigned int grid_60_idx8_len;
+
+extern const unsigned char Left_wav[];
+extern const unsigned int Left_wav_len;
+extern const unsigned char Right_wav[];
+extern const unsigned int Right_wav_len;
+
+#endif
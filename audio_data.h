@@ -1,9 +0,0 @@
-#ifndef AUDIO_DATA_H
-#define AUDIO_DATA_H
-
-extern unsigned char Left_wav[];
-extern unsigned int Left_wav_len;
-extern unsigned char Right_wav[];
-extern unsigned int Right_wav_len;
-
-#endif
@@ -0,0 +1,47 @@
+#ifndef AVTEST_H
+#define AVTEST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "libretro.h"
+
+/* The core behind the libretro entry points, for programs that link it
+ * directly and run several instances at once. Each avtest_* call matches
+ * the retro_* function of the same name, for the given instance.
+ *
+ * An instance must only be used by one thread at a time. Different
+ * instances only share read-only data and the SIMD kernel table, which
+ * the first avtest_init() picks once for the whole process. The
+ * frontend callbacks get no instance argument, so a program running
+ * several needs its own way, e.g. thread-local state, to tell them
+ * apart. Unlike retro_load_game(), avtest_load_game() does not register
+ * the frame time or audio buffer status callbacks; call
+ * avtest_frame_time() and avtest_audio_buffer_status() instead. */
+struct avtest;
+
+/* Returns a zeroed instance, or NULL when out of memory */
+struct avtest *avtest_create(void);
+void avtest_destroy(struct avtest *ctx);
+
+void avtest_set_environment(struct avtest *ctx, retro_environment_t cb);
+void avtest_set_video_refresh(struct avtest *ctx, retro_video_refresh_t cb);
+void avtest_set_audio_sample(struct avtest *ctx, retro_audio_sample_t cb);
+void avtest_set_audio_sample_batch(struct avtest *ctx, retro_audio_sample_batch_t cb);
+void avtest_set_input_poll(struct avtest *ctx, retro_input_poll_t cb);
+void avtest_set_input_state(struct avtest *ctx, retro_input_state_t cb);
+
+void avtest_init(struct avtest *ctx);
+void avtest_deinit(struct avtest *ctx);
+bool avtest_load_game(struct avtest *ctx, const struct retro_game_info *info);
+void avtest_unload_game(struct avtest *ctx);
+void avtest_run(struct avtest *ctx);
+void avtest_get_system_av_info(struct avtest *ctx, struct retro_system_av_info *info);
+
+void avtest_frame_time(struct avtest *ctx, retro_usec_t usec);
+void avtest_audio_buffer_status(struct avtest *ctx, bool active, unsigned occupancy, bool underrun_likely);
+
+void *avtest_get_memory_data(struct avtest *ctx, unsigned id);
+size_t avtest_get_memory_size(struct avtest *ctx, unsigned id);
+
+#endif
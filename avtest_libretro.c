@@ -1,40 +1,138 @@
+#include <errno.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "libretro.h"
-#include "images.h"
-#include "audio_data.h"
-
-#define FRAME_BUF_WIDTH 320
+#include "avtest.h"
+#include "assets.h"
+#include "font8x8.h"
+#include "kernels.h"
+#include "pack.h"
+#include "patterns.h"
+#include "markers.h"
+#include "stats.h"
+
+#define FRAME_BUF_WIDTH 320          /* also the width of the grids */
 #define FRAME_BUF_HEIGHT_NTSC 240
 #define FRAME_BUF_HEIGHT_PAL 288
-#define FRAME_BUF_MAX_HEIGHT FRAME_BUF_HEIGHT_PAL
-
-static uint32_t *frame_buf;
-static bool is_50hz = false;
-static bool prev_a_pressed = false;
-static bool prev_b_pressed = false;
-static bool prev_start_pressed = false;
-static bool audio_paused = false;
-static double audio_sample_rate = 48000.0;
-static double audio_frame_accum = 0.0;
-static int16_t *audio_buf = NULL;
-static size_t audio_buf_frames = 0;
-static bool audio_sequential = false;
-static bool audio_play_right = false;
-char retro_base_directory[4096];
-char retro_game_path[4096];
-
-static retro_video_refresh_t video_cb;
-static retro_audio_sample_t audio_cb;
-static retro_audio_sample_batch_t audio_batch_cb;
-static retro_environment_t environ_cb;
-static retro_input_poll_t input_poll_cb;
-static retro_input_state_t input_state_cb;
-static retro_log_printf_t log_cb;
+#define FRAME_BUF_MAX_WIDTH 1920
+#define FRAME_BUF_MAX_HEIGHT 1080
+#define FRAME_PITCH_ALIGN 64         /* rows start on a cache line */
+
+#define OVERLAY_X 8
+#define OVERLAY_Y 8
+#define OVERLAY_LINES 5
+#define OVERLAY_COLS 24
+#define OVERLAY_FG 0x00FFFFFF
+#define OVERLAY_BG 0x00000000
+
+#define MAX_INPUT_PORTS 8
+#define JOYPAD_BUTTONS 16
+#define BUTTON(id) (1 << (id))
+
+#define DRIFT_WINDOW_USEC 1000000
+#define DRIFT_WINDOWS 10
+
+#define BAR_WIDTH 16
+#define BAR_SPEED 4
+#define BAR_COLOR 0x00FFFFFF
+#define BAR_BG 0x00000000
+
+#define SCROLL_SPEED 1
+
+/* Audio stress limits: the highest avtest_audio_rate and the most video
+ * frames of audio per avtest_audio_batch batch */
+#define AUDIO_MAX_STRESS_RATE 192000
+#define AUDIO_MAX_BATCH 8
+
+/* The mix audio source plays the left WAV hard left and the right WAV
+ * hard right at full level, with a tone at source rate / MIX_TONE_PERIOD
+ * (1 kHz at 48 kHz) at MIX_TONE_GAIN and one period of it at
+ * MIX_CLICK_GAIN once a second as a sync click, both centred. Gains are
+ * Q15; the sum saturates. */
+#define MIX_MAX_SOURCES 4
+#define MIX_TONE_PERIOD 48
+#define MIX_TONE_FRAMES (MIX_TONE_PERIOD * 32)
+#define MIX_TONE_GAIN 3277   /* -20 dBFS */
+#define MIX_CLICK_GAIN 16384 /* -6 dBFS */
+
+/* One period of a full-scale sine */
+static const int16_t mix_sine[MIX_TONE_PERIOD] = {
+        0,   4277,   8481,  12539,  16383,  19947,  23170,  25996,
+    28377,  30273,  31650,  32487,  32767,  32487,  31650,  30273,
+    28377,  25996,  23170,  19947,  16383,  12539,   8481,   4277,
+        0,  -4277,  -8481, -12539, -16383, -19947, -23170, -25996,
+   -28377, -30273, -31650, -32487, -32767, -32487, -31650, -30273,
+   -28377, -25996, -23170, -19947, -16383, -12539,  -8481,  -4277,
+};
+
+/* Per-channel gains applied to the grid palette, in 1/256 steps: full,
+ * 75%, 50% and 25% brightness, then red, green and blue only. */
+struct palette_gain {
+   uint16_t r, g, b;
+};
+
+static const struct palette_gain palette_gains[] = {
+   { 256, 256, 256 },
+   { 192, 192, 192 },
+   { 128, 128, 128 },
+   {  64,  64,  64 },
+   { 256,   0,   0 },
+   {   0, 256,   0 },
+   {   0,   0, 256 },
+};
+
+#define PALETTE_MODES (sizeof(palette_gains) / sizeof(palette_gains[0]))
+
+enum test_pattern {
+   PATTERN_GRID = 0,
+   PATTERN_MOVING_BAR,
+   PATTERN_SCROLL,
+   /* calibration patterns, in enum calibration_pattern order */
+   PATTERN_SMPTE_BARS,
+   PATTERN_EBU_BARS,
+   PATTERN_GRAY_RAMP,
+   PATTERN_GAMMA_RAMP,
+   PATTERN_PLUGE,
+   PATTERN_CHECKERBOARD,
+   PATTERN_CROSSHATCH,
+   /* new content every frame, run unthrottled */
+   PATTERN_NOISE,
+   PATTERN_COUNT
+};
+
+/* avtest_pattern values, in enum test_pattern order */
+static const char *const pattern_keys[PATTERN_COUNT] = {
+   "grid", "moving_bar", "scroll", "smpte_bars", "ebu_bars", "gray_ramp",
+   "gamma_ramp", "pluge", "checkerboard", "crosshatch", "noise",
+};
+
+/* Which WAV plays on which channel when the WAVs are mono. ALTERNATE
+ * plays the left WAV on the left channel, then the right WAV on the
+ * right one; MIX plays both with a tone and sync clicks. */
+enum audio_source {
+   AUDIO_SOURCE_ALTERNATE = 0,
+   AUDIO_SOURCE_BOTH,
+   AUDIO_SOURCE_LEFT,
+   AUDIO_SOURCE_RIGHT,
+   AUDIO_SOURCE_MIX
+};
+
+/* A mixer input: a loop of period frames, of which the first frames
+ * come from pcm (little-endian mono) and the rest are silent */
+struct mix_source {
+   const uint8_t *pcm;
+   size_t frames;
+   size_t period;
+   size_t pos;
+   int16_t gain_l; /* Q15 */
+   int16_t gain_r;
+};
 
 struct wav_data {
    const uint8_t *pcm;
@@ -43,14 +141,147 @@ struct wav_data {
    uint16_t channels;
 };
 
-static struct wav_data left_wav_data;
-static struct wav_data right_wav_data;
-static bool audio_ready = false;
-static bool audio_use_stereo = false;
-static bool audio_has_right = false;
-static size_t left_pos = 0;
-static size_t right_pos = 0;
-static size_t stereo_pos = 0;
+/* Assets come from the pack in the system directory when it holds a
+ * valid copy, and from the ones linked into the core otherwise. */
+struct asset {
+   const uint8_t *data;
+   size_t size;
+};
+
+/* In asset_sources order */
+enum asset_id {
+   ASSET_GRID_PAL = 0,
+   ASSET_GRID_50,
+   ASSET_GRID_60,
+   ASSET_FONT,
+   ASSET_LEFT_WAV,
+   ASSET_RIGHT_WAV,
+   ASSET_COUNT
+};
+
+/* Audio clock drift meter. Audio frames handed to the frontend are
+ * counted per one second window and compared with both the monotonic
+ * clock and the frame time callback deltas over the last DRIFT_WINDOWS
+ * windows. */
+struct drift_window {
+   int64_t wall_usec;
+   int64_t frametime_usec;
+   uint64_t audio_frames;
+};
+
+/* Core options, as last read from the frontend */
+struct core_options {
+   bool is_50hz;
+   bool markers;
+   unsigned resolution_width;
+   unsigned resolution_height;
+   enum retro_pixel_format pixel_format;
+   enum audio_source audio_source;
+   unsigned audio_rate;
+   unsigned audio_batch;
+   enum test_pattern test_pattern;
+};
+
+/* One instance of the core: everything it changes while running. The
+ * libretro entry points drive the static instance below; avtest.h lets
+ * other programs run any number of them side by side. */
+struct avtest {
+   /* Set by the frontend, kept by reset_state() */
+   retro_video_refresh_t video_cb;
+   retro_audio_sample_t audio_cb;
+   retro_audio_sample_batch_t audio_batch_cb;
+   retro_environment_t environ_cb;
+   retro_input_poll_t input_poll_cb;
+   retro_input_state_t input_state_cb;
+   retro_log_printf_t log_cb;
+   bool input_bitmasks;
+   /* Registered by retro_load_game(), NULL for avtest.h instances */
+   retro_frame_time_callback_t frame_time_cb;
+
+   char base_directory[4096];
+   char game_path[4096];
+   struct pack pack;
+   struct asset assets[ASSET_COUNT];
+   struct core_options options;
+
+   uint8_t *frame_buf;
+   uint8_t *scroll_buf;
+   enum retro_pixel_format pixel_format;
+   unsigned frame_bpp;
+   bool is_50hz;
+   unsigned resolution_width;  /* 0 follows the refresh rate */
+   unsigned resolution_height;
+   unsigned input_max_users;
+   uint16_t prev_buttons[MAX_INPUT_PORTS];
+   enum test_pattern test_pattern;
+   unsigned palette_mode;
+   struct pixel_lut pattern_lut;
+   unsigned bar_x;
+   unsigned scroll_y;
+   uint32_t noise_state[NOISE_LANES];
+   unsigned noise_frames;
+   int64_t noise_start_usec;
+   bool markers_enabled;
+
+   bool audio_paused;
+   double audio_sample_rate;   /* output */
+   double audio_source_rate;   /* of the WAVs */
+   unsigned audio_rate_factor; /* output frames per WAV frame */
+   unsigned audio_stress_rate; /* 0 plays at the WAV rate */
+   unsigned audio_batch_size;  /* video frames per batch */
+   unsigned audio_batch_pending;
+   double audio_frame_accum;   /* WAV frames */
+   int16_t *audio_buf;
+   int16_t *audio_src_buf;     /* WAV rate, before upsampling */
+   size_t audio_buf_frames;
+   bool audio_sequential;
+   bool audio_play_right;
+   enum audio_source audio_source;
+   struct wav_data left_wav_data;
+   struct wav_data right_wav_data;
+   bool audio_ready;
+   bool audio_use_stereo;
+   bool audio_has_right;
+   size_t left_pos;
+   size_t right_pos;
+   size_t stereo_pos;
+   struct mix_source mix_sources[MIX_MAX_SOURCES];
+   unsigned mix_source_count;
+   uint8_t mix_tone[MIX_TONE_FRAMES * 2];
+
+   /* Statistics overlay. Glyphs are expanded to output pixels once and
+    * each text line is only redrawn when its contents change. */
+   uint8_t glyph_atlas[FONT8X8_NUM_GLYPHS][8 * 8 * 4];
+   bool glyph_atlas_ready;
+   bool overlay_enabled;
+   char overlay_drawn[OVERLAY_LINES][OVERLAY_COLS];
+   size_t last_audio_frames;
+   int64_t fps_window_start;
+   unsigned fps_window_frames;
+   double measured_fps;
+   /* Audio frames sent minus the sample rate times the time passed since
+    * the overlay came on, updated with the FPS */
+   int64_t overlay_drift_start;
+   uint64_t overlay_drift_frames;
+   double overlay_drift_rate;
+   bool overlay_drift_valid;
+   int64_t overlay_drift;
+
+   struct avtest_stats stats;
+   struct retro_memory_descriptor stats_descriptor;
+
+   bool drift_meter_enabled;
+   struct drift_window drift_windows[DRIFT_WINDOWS];
+   unsigned drift_window_head;
+   unsigned drift_window_count;
+   struct drift_window drift_current;
+   int64_t drift_window_start;
+   bool drift_have_frametime;
+   double drift_ppm_wall;
+   double drift_ppm_frametime;
+};
+
+static struct avtest core;
 
 static uint16_t read_le_u16(const uint8_t *data)
 {
@@ -65,11 +296,6 @@ static uint32_t read_le_u32(const uint8_t *data)
           (uint32_t)(data[3] << 24);
 }
 
-static int16_t read_le_s16(const uint8_t *data)
-{
-   return (int16_t)((uint16_t)data[0] | (uint16_t)(data[1] << 8));
-}
-
 static bool parse_wav(const uint8_t *wav, size_t wav_size, struct wav_data *out)
 {
    if (!wav || wav_size < 12)
@@ -132,326 +358,1400 @@ static bool parse_wav(const uint8_t *wav, size_t wav_size, struct wav_data *out)
    return true;
 }
 
-static void ensure_audio_buffer(size_t frames)
+static void ensure_audio_buffer(struct avtest *ctx, size_t frames)
 {
-   if (frames <= audio_buf_frames)
+   if (frames <= ctx->audio_buf_frames)
       return;
 
-   int16_t *new_buf = realloc(audio_buf, frames * 2 * sizeof(int16_t));
+   int16_t *new_buf = realloc(ctx->audio_buf, frames * 2 * sizeof(int16_t));
    if (!new_buf)
       return;
+   ctx->audio_buf = new_buf;
 
-   audio_buf = new_buf;
-   audio_buf_frames = frames;
+   new_buf = realloc(ctx->audio_src_buf, frames * 2 * sizeof(int16_t));
+   if (!new_buf)
+      return;
+   ctx->audio_src_buf = new_buf;
+   ctx->audio_buf_frames = frames;
+}
+
+static void audio_reset_positions(struct avtest *ctx)
+{
+   ctx->left_pos = 0;
+   ctx->right_pos = 0;
+   ctx->stereo_pos = 0;
+   ctx->audio_frame_accum = 0.0;
+   ctx->audio_batch_pending = 0;
+   ctx->audio_play_right = false;
+   for (unsigned i = 0; i < ctx->mix_source_count; i++)
+      ctx->mix_sources[i].pos = 0;
 }
 
-static void audio_reset_positions(void)
+/* pan runs from -32767 (left only) to 32767 (right only); the far
+ * channel is attenuated linearly and the near one keeps the gain */
+static void mix_add_source(struct avtest *ctx, const uint8_t *pcm, size_t frames, size_t period,
+                           int16_t gain, int16_t pan)
 {
-   left_pos = 0;
-   right_pos = 0;
-   stereo_pos = 0;
-   audio_frame_accum = 0.0;
-   audio_play_right = false;
+   struct mix_source *src;
+
+   if (!pcm || frames == 0 || ctx->mix_source_count == MIX_MAX_SOURCES)
+      return;
+
+   src = &ctx->mix_sources[ctx->mix_source_count++];
+   src->pcm = pcm;
+   src->frames = frames;
+   src->period = period > frames ? period : frames;
+   src->pos = 0;
+   src->gain_l = pan > 0 ? (int16_t)(gain * (32767 - pan) / 32767) : gain;
+   src->gain_r = pan < 0 ? (int16_t)(gain * (32767 + pan) / 32767) : gain;
 }
 
-static void audio_init(void)
+static void mix_setup(struct avtest *ctx)
+{
+   ctx->mix_source_count = 0;
+   if (ctx->audio_source != AUDIO_SOURCE_MIX)
+      return;
+
+   for (size_t i = 0; i < MIX_TONE_FRAMES; i++) {
+      uint16_t v = (uint16_t)mix_sine[i % MIX_TONE_PERIOD];
+      ctx->mix_tone[i * 2 + 0] = (uint8_t)v;
+      ctx->mix_tone[i * 2 + 1] = (uint8_t)(v >> 8);
+   }
+
+   mix_add_source(ctx, ctx->left_wav_data.pcm, ctx->left_wav_data.frames, 0, 32767, -32767);
+   if (ctx->audio_has_right)
+      mix_add_source(ctx, ctx->right_wav_data.pcm, ctx->right_wav_data.frames, 0, 32767, 32767);
+   mix_add_source(ctx, ctx->mix_tone, MIX_TONE_FRAMES, 0, MIX_TONE_GAIN, 0);
+   mix_add_source(ctx, ctx->mix_tone, MIX_TONE_PERIOD, (size_t)ctx->audio_source_rate, MIX_CLICK_GAIN, 0);
+}
+
+/* Sums every source into silence. Each pass covers the longest run of
+ * a source that needs no wrap; its silent part costs nothing. */
+static void mix_generate(struct avtest *ctx, int16_t *out, size_t frames)
+{
+   memset(out, 0, frames * 2 * sizeof(int16_t));
+
+   for (unsigned s = 0; s < ctx->mix_source_count; s++) {
+      struct mix_source *src = &ctx->mix_sources[s];
+
+      for (size_t done = 0; done < frames;) {
+         if (src->pos >= src->period)
+            src->pos = 0;
+
+         size_t end = src->pos < src->frames ? src->frames : src->period;
+         size_t n = end - src->pos;
+         if (n > frames - done)
+            n = frames - done;
+
+         if (src->pos < src->frames)
+            kernels.mix_s16(out + done * 2, src->pcm + src->pos * 2, n, src->gain_l, src->gain_r);
+         src->pos += n;
+         done += n;
+      }
+   }
+}
+
+static bool valid_palette(const uint8_t *data, size_t size)
+{
+   return size >= 4 && read_le_u32(data) <= 256 && size >= 4 + (size_t)read_le_u32(data) * 4;
+}
+
+static bool valid_grid_50(const uint8_t *data, size_t size)
+{
+   (void)data;
+   return size == FRAME_BUF_WIDTH * FRAME_BUF_HEIGHT_PAL;
+}
+
+static bool valid_grid_60(const uint8_t *data, size_t size)
+{
+   (void)data;
+   return size == FRAME_BUF_WIDTH * FRAME_BUF_HEIGHT_NTSC;
+}
+
+static bool valid_font(const uint8_t *data, size_t size)
+{
+   (void)data;
+   return size == sizeof(font8x8);
+}
+
+static bool valid_wav(const uint8_t *data, size_t size)
+{
+   struct wav_data wav;
+   return parse_wav(data, size, &wav);
+}
+
+struct asset_source {
+   const char *name;
+   const uint8_t *embedded;
+   const unsigned *embedded_len;
+   bool (*valid)(const uint8_t *data, size_t size);
+};
+
+static const unsigned font8x8_len = sizeof(font8x8);
+
+/* In enum asset_id order */
+static const struct asset_source asset_sources[ASSET_COUNT] = {
+   { "grid.pal",     grid_pal,       &grid_pal_len,     valid_palette },
+   { "grid_50.idx8", grid_50_idx8,   &grid_50_idx8_len, valid_grid_50 },
+   { "grid_60.idx8", grid_60_idx8,   &grid_60_idx8_len, valid_grid_60 },
+   { "font8x8.bin",  &font8x8[0][0], &font8x8_len,      valid_font },
+   { "Left.wav",     Left_wav,       &Left_wav_len,     valid_wav },
+   { "Right.wav",    Right_wav,      &Right_wav_len,    valid_wav },
+};
+
+/* The grids are indices into grid.pal, so the three come from the pack
+ * together or not at all. Returns why the pack's set cannot be used, or
+ * NULL when it can. */
+static const char *check_pack_grids(const uint8_t *data[], const size_t size[])
+{
+   unsigned found = 0;
+
+   for (size_t i = ASSET_GRID_PAL; i <= ASSET_GRID_60; i++)
+      found += data[i] != NULL;
+   if (found == 0)
+      return "";
+   if (found < 3)
+      return "it needs grid.pal, grid_50.idx8 and grid_60.idx8 together";
+
+   for (size_t i = ASSET_GRID_PAL; i <= ASSET_GRID_60; i++) {
+      if (!asset_sources[i].valid(data[i], size[i]))
+         return i == ASSET_GRID_PAL ? "grid.pal is invalid"
+              : i == ASSET_GRID_50 ? "grid_50.idx8 is invalid" : "grid_60.idx8 is invalid";
+   }
+
+   const uint32_t colors = read_le_u32(data[ASSET_GRID_PAL]);
+   for (size_t i = ASSET_GRID_50; i <= ASSET_GRID_60; i++) {
+      for (size_t p = 0; p < size[i]; p++) {
+         if (data[i][p] >= colors)
+            return "a grid uses a color past the end of grid.pal";
+      }
+   }
+
+   return NULL;
+}
+
+/* Maps the asset pack, if any, and picks the source of every asset. The
+ * pack stays mapped until retro_deinit(); pages of assets that are never
+ * used are never read, except the grids, which are checked in full. */
+static void load_assets(struct avtest *ctx)
+{
+   char path[sizeof(ctx->base_directory) + sizeof(PACK_FILE_NAME) + 1];
+   bool have_pack = false;
+
+   if (ctx->base_directory[0]) {
+      snprintf(path, sizeof(path), "%s/%s", ctx->base_directory, PACK_FILE_NAME);
+      have_pack = pack_open(&ctx->pack, path);
+      if (have_pack && ctx->log_cb)
+         ctx->log_cb(RETRO_LOG_INFO, "Asset pack: %s\n", path);
+      else if (!have_pack && errno != ENOENT && ctx->log_cb)
+         ctx->log_cb(RETRO_LOG_WARN, "Asset pack: cannot use %s, using built-in assets.\n", path);
+   }
+
+   const uint8_t *found[ASSET_COUNT];
+   size_t found_size[ASSET_COUNT];
+
+   for (size_t i = 0; i < ASSET_COUNT; i++) {
+      found_size[i] = 0;
+      found[i] = have_pack ? pack_find(&ctx->pack, asset_sources[i].name, &found_size[i]) : NULL;
+   }
+
+   const char *grids_rejected = check_pack_grids(found, found_size);
+   if (grids_rejected) {
+      if (grids_rejected[0] && ctx->log_cb)
+         ctx->log_cb(RETRO_LOG_WARN, "Asset pack: using the built-in grids, %s.\n", grids_rejected);
+      for (size_t i = ASSET_GRID_PAL; i <= ASSET_GRID_60; i++)
+         found[i] = NULL;
+   }
+
+   for (size_t i = 0; i < ASSET_COUNT; i++) {
+      const struct asset_source *src = &asset_sources[i];
+      size_t size = found_size[i];
+      const uint8_t *data = found[i];
+
+      if (data && !src->valid(data, size)) {
+         if (ctx->log_cb)
+            ctx->log_cb(RETRO_LOG_WARN, "Asset pack: %s is invalid, using the built-in one.\n", src->name);
+         data = NULL;
+      } else if (data && ctx->log_cb) {
+         ctx->log_cb(RETRO_LOG_INFO, "Asset pack: using %s.\n", src->name);
+      }
+
+      if (!data) {
+         data = src->embedded;
+         size = *src->embedded_len;
+      }
+
+      ctx->assets[i].data = data;
+      ctx->assets[i].size = size;
+   }
+}
+
+static void audio_init(struct avtest *ctx)
 {
    struct wav_data left = {0};
    struct wav_data right = {0};
 
-   bool left_ok = parse_wav(Left_wav, Left_wav_len, &left);
-   bool right_ok = parse_wav(Right_wav, Right_wav_len, &right);
+   bool left_ok = parse_wav(ctx->assets[ASSET_LEFT_WAV].data, ctx->assets[ASSET_LEFT_WAV].size, &left);
+   bool right_ok = parse_wav(ctx->assets[ASSET_RIGHT_WAV].data, ctx->assets[ASSET_RIGHT_WAV].size, &right);
 
-   audio_ready = false;
-   audio_use_stereo = false;
-   audio_has_right = false;
-   audio_sequential = false;
+   ctx->audio_ready = false;
+   ctx->audio_use_stereo = false;
+   ctx->audio_has_right = false;
+   ctx->audio_sequential = false;
 
    if (!left_ok && !right_ok) {
-      if (log_cb)
-         log_cb(RETRO_LOG_WARN, "Audio: failed to parse embedded WAV data.\n");
+      if (ctx->log_cb)
+         ctx->log_cb(RETRO_LOG_WARN, "Audio: failed to parse WAV data.\n");
       return;
    }
 
    if (left_ok && left.channels == 2) {
-      left_wav_data = left;
-      audio_sample_rate = left.sample_rate;
-      audio_use_stereo = true;
-      audio_ready = true;
+      ctx->left_wav_data = left;
+      ctx->audio_sample_rate = left.sample_rate;
+      ctx->audio_use_stereo = true;
+      ctx->audio_ready = true;
    } else {
       if (right_ok && right.channels != 1) {
-         if (log_cb)
-            log_cb(RETRO_LOG_WARN, "Audio: right WAV is not mono, ignoring right channel.\n");
+         if (ctx->log_cb)
+            ctx->log_cb(RETRO_LOG_WARN, "Audio: right WAV is not mono, ignoring right channel.\n");
          right_ok = false;
       }
 
       if (left_ok)
-         left_wav_data = left;
+         ctx->left_wav_data = left;
       if (right_ok)
-         right_wav_data = right;
+         ctx->right_wav_data = right;
 
-      audio_has_right = right_ok && right.channels == 1;
-      audio_sequential = left_ok && right_ok;
-      audio_ready = left_ok || right_ok;
+      ctx->audio_has_right = right_ok && right.channels == 1;
+      ctx->audio_sequential = left_ok && right_ok && ctx->audio_source == AUDIO_SOURCE_ALTERNATE;
+      ctx->audio_ready = left_ok || right_ok;
 
       if (left_ok)
-         audio_sample_rate = left.sample_rate;
+         ctx->audio_sample_rate = left.sample_rate;
       else
-         audio_sample_rate = right.sample_rate;
+         ctx->audio_sample_rate = right.sample_rate;
 
-      if (left_ok && right_ok && left.sample_rate != right.sample_rate && log_cb) {
-         log_cb(RETRO_LOG_WARN,
+      if (left_ok && right_ok && left.sample_rate != right.sample_rate && ctx->log_cb) {
+         ctx->log_cb(RETRO_LOG_WARN,
                 "Audio: left/right sample rates differ (%u vs %u), using left.\n",
                 left.sample_rate, right.sample_rate);
       }
 
       if (!left_ok && right_ok) {
-         left_wav_data = right;
-         audio_has_right = false;
-         audio_sequential = false;
-         if (log_cb)
-            log_cb(RETRO_LOG_WARN, "Audio: left WAV missing, mirroring right channel.\n");
+         ctx->left_wav_data = right;
+         ctx->audio_has_right = false;
+         ctx->audio_sequential = false;
+         if (ctx->log_cb)
+            ctx->log_cb(RETRO_LOG_WARN, "Audio: left WAV missing, mirroring right channel.\n");
       }
    }
 
-   if (audio_sample_rate <= 0.0)
-      audio_sample_rate = 48000.0;
-
-   size_t max_frames = (size_t)(audio_sample_rate / 50.0) + 2;
-   ensure_audio_buffer(max_frames);
-   audio_reset_positions();
+   if (ctx->audio_sample_rate <= 0.0)
+      ctx->audio_sample_rate = 48000.0;
+
+   /* The stress rates repeat every WAV frame a whole number of times,
+    * which hits them exactly for 48 kHz WAVs. */
+   ctx->audio_source_rate = ctx->audio_sample_rate;
+   ctx->audio_rate_factor = 1;
+   if (ctx->audio_stress_rate > ctx->audio_source_rate)
+      ctx->audio_rate_factor = (unsigned)(ctx->audio_stress_rate / ctx->audio_source_rate + 0.5);
+   ctx->audio_sample_rate = ctx->audio_source_rate * ctx->audio_rate_factor;
+
+   /* Sized for the highest rate and the largest batch at 50 Hz, so that
+    * option changes never reallocate. */
+   unsigned max_factor = (unsigned)(AUDIO_MAX_STRESS_RATE / ctx->audio_source_rate + 0.5);
+   if (max_factor < ctx->audio_rate_factor)
+      max_factor = ctx->audio_rate_factor;
+   size_t max_frames = ((size_t)(ctx->audio_source_rate / 50.0) + 2) * AUDIO_MAX_BATCH * max_factor;
+   ensure_audio_buffer(ctx, max_frames);
+   mix_setup(ctx);
+   audio_reset_positions(ctx);
 }
 
-static void audio_generate(int16_t *out, size_t frames)
+static void audio_generate(struct avtest *ctx, int16_t *out, size_t frames)
 {
    if (!out || frames == 0) {
       return;
    }
 
-   if (!audio_ready || audio_paused) {
+   if (!ctx->audio_ready || ctx->audio_paused) {
       memset(out, 0, frames * 2 * sizeof(int16_t));
       return;
    }
 
-   if (audio_use_stereo && left_wav_data.frames > 0) {
-      for (size_t i = 0; i < frames; i++) {
-         size_t pos = stereo_pos;
-         if (pos >= left_wav_data.frames)
-            pos = 0;
-         const uint8_t *pcm = left_wav_data.pcm + (pos * 4);
-         out[i * 2 + 0] = read_le_s16(pcm + 0);
-         out[i * 2 + 1] = read_le_s16(pcm + 2);
-         stereo_pos = pos + 1;
+   /* Each pass hands the kernels the longest run that needs no wrap. */
+   size_t done = 0;
+
+   if (ctx->audio_use_stereo && ctx->left_wav_data.frames > 0) {
+      while (done < frames) {
+         if (ctx->stereo_pos >= ctx->left_wav_data.frames)
+            ctx->stereo_pos = 0;
+
+         size_t n = ctx->left_wav_data.frames - ctx->stereo_pos;
+         if (n > frames - done)
+            n = frames - done;
+
+         kernels.copy_stereo_s16(out + done * 2, ctx->left_wav_data.pcm + ctx->stereo_pos * 4, n);
+         ctx->stereo_pos += n;
+         done += n;
       }
       return;
    }
 
-   if (audio_sequential && left_wav_data.frames > 0 && right_wav_data.frames > 0) {
-      for (size_t i = 0; i < frames; i++) {
-         if (!audio_play_right) {
-            if (left_pos >= left_wav_data.frames) {
-               left_pos = 0;
-               audio_play_right = true;
-               right_pos = 0;
+   if (ctx->audio_source == AUDIO_SOURCE_MIX) {
+      mix_generate(ctx, out, frames);
+      return;
+   }
+
+   if (ctx->audio_sequential && ctx->left_wav_data.frames > 0 && ctx->right_wav_data.frames > 0) {
+      while (done < frames) {
+         if (!ctx->audio_play_right) {
+            if (ctx->left_pos >= ctx->left_wav_data.frames) {
+               ctx->left_pos = 0;
+               ctx->audio_play_right = true;
+               ctx->right_pos = 0;
             }
          } else {
-            if (right_pos >= right_wav_data.frames) {
-               right_pos = 0;
-               audio_play_right = false;
-               left_pos = 0;
+            if (ctx->right_pos >= ctx->right_wav_data.frames) {
+               ctx->right_pos = 0;
+               ctx->audio_play_right = false;
+               ctx->left_pos = 0;
             }
          }
 
-         int16_t left_sample = 0;
-         int16_t right_sample = 0;
-
-         if (!audio_play_right) {
-            left_sample = read_le_s16(left_wav_data.pcm + (left_pos * 2));
-            left_pos++;
+         size_t n;
+         if (!ctx->audio_play_right) {
+            n = ctx->left_wav_data.frames - ctx->left_pos;
+            if (n > frames - done)
+               n = frames - done;
+            kernels.interleave_s16(out + done * 2, ctx->left_wav_data.pcm + ctx->left_pos * 2, NULL, n);
+            ctx->left_pos += n;
          } else {
-            right_sample = read_le_s16(right_wav_data.pcm + (right_pos * 2));
-            right_pos++;
+            n = ctx->right_wav_data.frames - ctx->right_pos;
+            if (n > frames - done)
+               n = frames - done;
+            kernels.interleave_s16(out + done * 2, NULL, ctx->right_wav_data.pcm + ctx->right_pos * 2, n);
+            ctx->right_pos += n;
          }
-
-         out[i * 2 + 0] = left_sample;
-         out[i * 2 + 1] = right_sample;
+         done += n;
       }
       return;
    }
 
-   for (size_t i = 0; i < frames; i++) {
-      size_t lpos = left_pos;
-      if (left_wav_data.frames > 0 && lpos >= left_wav_data.frames)
-         lpos = 0;
+   bool use_right = ctx->audio_has_right && ctx->right_wav_data.frames > 0;
 
-      size_t rpos = right_pos;
-      if (right_wav_data.frames > 0 && rpos >= right_wav_data.frames)
-         rpos = 0;
+   while (done < frames) {
+      if (ctx->left_wav_data.frames > 0 && ctx->left_pos >= ctx->left_wav_data.frames)
+         ctx->left_pos = 0;
 
-      int16_t left_sample = 0;
-      int16_t right_sample = 0;
+      if (ctx->right_wav_data.frames > 0 && ctx->right_pos >= ctx->right_wav_data.frames)
+         ctx->right_pos = 0;
 
-      if (left_wav_data.frames > 0)
-         left_sample = read_le_s16(left_wav_data.pcm + (lpos * 2));
+      size_t n = frames - done;
+      if (ctx->left_wav_data.frames > 0 && ctx->left_wav_data.frames - ctx->left_pos < n)
+         n = ctx->left_wav_data.frames - ctx->left_pos;
+      if (use_right && ctx->right_wav_data.frames - ctx->right_pos < n)
+         n = ctx->right_wav_data.frames - ctx->right_pos;
 
-      if (audio_has_right && right_wav_data.frames > 0)
-         right_sample = read_le_s16(right_wav_data.pcm + (rpos * 2));
-      else
-         right_sample = left_sample;
+      const uint8_t *left = ctx->left_wav_data.frames > 0 ? ctx->left_wav_data.pcm + ctx->left_pos * 2 : NULL;
+      const uint8_t *right = use_right ? ctx->right_wav_data.pcm + ctx->right_pos * 2 : left;
 
-      out[i * 2 + 0] = left_sample;
-      out[i * 2 + 1] = right_sample;
+      if (ctx->audio_source == AUDIO_SOURCE_LEFT)
+         right = NULL;
+      else if (ctx->audio_source == AUDIO_SOURCE_RIGHT)
+         left = NULL;
 
-      left_pos = lpos + 1;
-      right_pos = rpos + 1;
+      kernels.interleave_s16(out + done * 2, left, right, n);
+      ctx->left_pos += n;
+      ctx->right_pos += n;
+      done += n;
    }
 }
 
-static void render_audio(void)
+/* Overwrites the first frames of a batch with the audio marker */
+static void marker_write_audio(struct avtest *ctx, int16_t *out, size_t frames)
 {
-   if (!audio_batch_cb && !audio_cb)
+   for (size_t i = 0; i < frames && i < MARKER_AUDIO_FRAMES; i++) {
+      const bool high = i < MARKER_AUDIO_SYNC
+                        ? (i & 1) == 0
+                        : (ctx->stats.frames >> (MARKER_AUDIO_FRAMES - 1 - i)) & 1;
+      out[i * 2 + 0] = high ? MARKER_LEVEL : -MARKER_LEVEL;
+      out[i * 2 + 1] = high ? -MARKER_LEVEL : MARKER_LEVEL;
+   }
+}
+
+static void render_audio(struct avtest *ctx)
+{
+   if (!ctx->audio_batch_cb && !ctx->audio_cb)
       return;
 
-   double fps = is_50hz ? 50.0 : 60.0;
-   if (fps <= 0.0 || audio_sample_rate <= 0.0)
+   double fps = ctx->is_50hz ? 50.0 : 60.0;
+   if (fps <= 0.0 || ctx->audio_sample_rate <= 0.0)
       return;
 
-   audio_frame_accum += audio_sample_rate / fps;
-   size_t frames = (size_t)audio_frame_accum;
-   audio_frame_accum -= frames;
+   ctx->audio_frame_accum += ctx->audio_source_rate / fps;
 
-   if (frames == 0)
+   /* Batches of several video frames go out whole on their last frame */
+   if (++ctx->audio_batch_pending < ctx->audio_batch_size)
       return;
+   ctx->audio_batch_pending = 0;
+
+   size_t source_frames = (size_t)ctx->audio_frame_accum;
+   ctx->audio_frame_accum -= source_frames;
+
+   size_t frames = source_frames * ctx->audio_rate_factor;
+   ctx->last_audio_frames = frames;
 
-   ensure_audio_buffer(frames);
-   if (audio_buf_frames < frames)
+   if (frames == 0)
       return;
 
-   audio_generate(audio_buf, frames);
+   /* audio_init(ctx) sized the buffer for the lowest refresh rate. */
+   if (ctx->audio_buf_frames < frames)
+      return;
 
-   if (audio_batch_cb) {
-      audio_batch_cb(audio_buf, frames);
+   if (ctx->audio_rate_factor > 1) {
+      audio_generate(ctx, ctx->audio_src_buf, source_frames);
+      kernels.upsample_s16(ctx->audio_buf, ctx->audio_src_buf, source_frames, ctx->audio_rate_factor);
+   } else {
+      audio_generate(ctx, ctx->audio_buf, frames);
+   }
+   if (ctx->markers_enabled)
+      marker_write_audio(ctx, ctx->audio_buf, frames);
+   ctx->stats.audio_frames += frames;
+   if (ctx->drift_meter_enabled)
+      ctx->drift_current.audio_frames += frames;
+
+   if (ctx->audio_batch_cb) {
+      if (ctx->audio_batch_cb(ctx->audio_buf, frames) < frames)
+         ctx->stats.audio_short_writes++;
       return;
    }
 
    for (size_t i = 0; i < frames; i++)
-      audio_cb(audio_buf[i * 2 + 0], audio_buf[i * 2 + 1]);
+      ctx->audio_cb(ctx->audio_buf[i * 2 + 0], ctx->audio_buf[i * 2 + 1]);
+}
+
+/* Converts an XRGB8888 color constant to the output pixel format. */
+static uint32_t map_color(struct avtest *ctx, uint32_t xrgb)
+{
+   if (ctx->pixel_format == RETRO_PIXEL_FORMAT_RGB565)
+      return ((xrgb >> 8) & 0xF800) | ((xrgb >> 5) & 0x07E0) | ((xrgb >> 3) & 0x001F);
+   return xrgb;
+}
+
+static void store_pixel(struct avtest *ctx, uint8_t *dst, uint32_t pixel)
+{
+   if (ctx->frame_bpp == 2)
+      *(uint16_t *)dst = (uint16_t)pixel;
+   else
+      *(uint32_t *)dst = pixel;
+}
+
+static bool is_calibration_pattern(struct avtest *ctx)
+{
+   return ctx->test_pattern >= PATTERN_SMPTE_BARS && ctx->test_pattern <= PATTERN_CROSSHATCH;
+}
+
+/* Rebuilds the palette of the current pattern for the current pixel
+ * format and palette mode. The patterns themselves are indices and stay
+ * untouched. */
+static void apply_palette(struct avtest *ctx)
+{
+   const struct palette_gain *gain = &palette_gains[ctx->palette_mode];
+   uint32_t colors[256];
+   unsigned count;
+
+   if (is_calibration_pattern(ctx)) {
+      count = calibration_palette((enum calibration_pattern)(ctx->test_pattern - PATTERN_SMPTE_BARS),
+                                  colors);
+   } else {
+      count = read_le_u32(ctx->assets[ASSET_GRID_PAL].data);
+      if (count > 256)
+         count = 256;
+      for (unsigned i = 0; i < count; i++)
+         colors[i] = read_le_u32(ctx->assets[ASSET_GRID_PAL].data + 4 + i * 4);
+   }
+
+   for (unsigned i = 0; i < count; i++) {
+      uint32_t xrgb = colors[i];
+      uint32_t r = ((xrgb >> 16) & 0xFF) * gain->r >> 8;
+      uint32_t g = ((xrgb >> 8) & 0xFF) * gain->g >> 8;
+      uint32_t b = (xrgb & 0xFF) * gain->b >> 8;
+      colors[i] = map_color(ctx, (r << 16) | (g << 8) | b);
+   }
+
+   pixel_lut_init(&ctx->pattern_lut, colors, count, ctx->frame_bpp);
+}
+
+/* Output height: the resolution option, or 240 lines at 60 Hz and 288
+ * at 50 Hz. */
+static unsigned frame_height(struct avtest *ctx)
+{
+   if (ctx->resolution_height)
+      return ctx->resolution_height;
+   return ctx->is_50hz ? FRAME_BUF_HEIGHT_PAL : FRAME_BUF_HEIGHT_NTSC;
+}
+
+static unsigned frame_width(struct avtest *ctx)
+{
+   return ctx->resolution_width ? ctx->resolution_width : FRAME_BUF_WIDTH;
+}
+
+static size_t frame_pitch(struct avtest *ctx)
+{
+   return ((size_t)frame_width(ctx) * ctx->frame_bpp + FRAME_PITCH_ALIGN - 1) & ~(size_t)(FRAME_PITCH_ALIGN - 1);
+}
+
+static size_t frame_bytes(struct avtest *ctx)
+{
+   return frame_pitch(ctx) * frame_height(ctx);
+}
+
+/* The grids are tiled over the larger modes: the 320x288 one at 288
+ * lines, the 320x240 one otherwise. One grid's worth of rows is drawn,
+ * the rest are copies of it. */
+static void draw_bg_rows(struct avtest *ctx, uint8_t *buf, unsigned first_row, unsigned rows)
+{
+   const unsigned grid_height = frame_height(ctx) == FRAME_BUF_HEIGHT_PAL ? FRAME_BUF_HEIGHT_PAL
+                                                                       : FRAME_BUF_HEIGHT_NTSC;
+   const uint8_t *indices = grid_height == FRAME_BUF_HEIGHT_PAL ? ctx->assets[ASSET_GRID_50].data
+                                                                : ctx->assets[ASSET_GRID_60].data;
+   const size_t pitch = frame_pitch(ctx);
+   const size_t row_bytes = (size_t)frame_width(ctx) * ctx->frame_bpp;
+   const size_t tile_bytes = FRAME_BUF_WIDTH * ctx->frame_bpp;
+
+   const unsigned drawn = rows < grid_height ? rows : grid_height;
+   uint8_t *first = buf + first_row * pitch;
+
+   for (unsigned y = first_row; y < first_row + drawn; y++) {
+      uint8_t *row = buf + y * pitch;
+
+      kernels.expand_idx8(row, indices + (y % grid_height) * FRAME_BUF_WIDTH, FRAME_BUF_WIDTH,
+                          &ctx->pattern_lut);
+      for (size_t done = tile_bytes; done < row_bytes; done *= 2)
+         memcpy(row + done, row, row_bytes - done < done ? row_bytes - done : done);
+   }
+
+   if (rows > drawn)
+      frame_repeat(first, drawn * pitch, rows * pitch, frame_bytes(ctx));
+}
+
+static void overlay_invalidate(struct avtest *ctx)
+{
+   memset(ctx->overlay_drawn, 0, sizeof(ctx->overlay_drawn));
+}
+
+/* Fills one column of the moving bar pattern. Pixels under the overlay
+ * are left alone so the bar never erases text that is still current. */
+static void fill_bar_column(struct avtest *ctx, unsigned x, unsigned first_row, unsigned rows, uint32_t pixel)
+{
+   const size_t pitch = frame_pitch(ctx);
+   const unsigned end = first_row + rows;
+   unsigned skip_begin = end;
+   unsigned skip_end = end;
+   uint8_t *dst = ctx->frame_buf + first_row * pitch + x * ctx->frame_bpp;
+
+   if (ctx->overlay_enabled && x >= OVERLAY_X && x < OVERLAY_X + OVERLAY_COLS * 8) {
+      skip_begin = OVERLAY_Y;
+      skip_end = OVERLAY_Y + OVERLAY_LINES * 8;
+   }
+
+   for (unsigned y = first_row; y < end; y++, dst += pitch) {
+      if (y >= skip_begin && y < skip_end)
+         continue;
+      store_pixel(ctx, dst, pixel);
+   }
+}
+
+static bool bar_covers(struct avtest *ctx, unsigned x)
+{
+   return (x + frame_width(ctx) - ctx->bar_x) % frame_width(ctx) < BAR_WIDTH;
+}
+
+static void draw_pattern_rows(struct avtest *ctx, unsigned first_row, unsigned rows)
+{
+   switch (ctx->test_pattern) {
+      case PATTERN_MOVING_BAR: {
+         const uint32_t bar = map_color(ctx, BAR_COLOR);
+         const uint32_t bg = map_color(ctx, BAR_BG);
+         const size_t pitch = frame_pitch(ctx);
+         uint8_t *first = ctx->frame_buf + first_row * pitch;
+
+         /* every row is the same */
+         for (unsigned x = 0; x < frame_width(ctx); x++)
+            store_pixel(ctx, first + x * ctx->frame_bpp, bar_covers(ctx, x) ? bar : bg);
+         frame_repeat(first, pitch, rows * pitch, frame_bytes(ctx));
+         break;
+      }
+      case PATTERN_SCROLL:
+         /* presented straight from scroll_buf */
+         break;
+      case PATTERN_NOISE:
+         /* filled by avtest_run(ctx) */
+         break;
+      case PATTERN_GRID:
+         draw_bg_rows(ctx, ctx->frame_buf, first_row, rows);
+         break;
+      default:
+         /* drawn whole: a frame is a few row copies */
+         calibration_draw((enum calibration_pattern)(ctx->test_pattern - PATTERN_SMPTE_BARS), ctx->frame_buf,
+                          frame_pitch(ctx), frame_width(ctx), frame_height(ctx), &ctx->pattern_lut);
+         break;
+   }
+}
+
+/* Moves the bar by BAR_SPEED pixels, touching only the columns it left
+ * and the columns it entered. */
+static void advance_moving_bar(struct avtest *ctx)
+{
+   const unsigned width = frame_width(ctx);
+   const unsigned height = frame_height(ctx);
+   const uint32_t bar = map_color(ctx, BAR_COLOR);
+   const uint32_t bg = map_color(ctx, BAR_BG);
+
+   for (unsigned i = 0; i < BAR_SPEED; i++) {
+      fill_bar_column(ctx, (ctx->bar_x + i) % width, 0, height, bg);
+      fill_bar_column(ctx, (ctx->bar_x + BAR_WIDTH + i) % width, 0, height, bar);
+   }
+
+   ctx->bar_x = (ctx->bar_x + BAR_SPEED) % width;
+}
+
+/* Redraws the current pattern into frame_buf, which retro_init() sized
+ * for the largest mode so that switching never allocates. The scrolling
+ * pattern instead holds the grid twice in scroll_buf, so that every
+ * window of frame_height() rows is one contiguous frame. */
+static void load_bg(struct avtest *ctx)
+{
+   const unsigned height = frame_height(ctx);
+
+   if (!ctx->frame_buf || !ctx->scroll_buf)
+      return;
+
+   apply_palette(ctx);
+   ctx->bar_x %= frame_width(ctx);
+   if (ctx->test_pattern == PATTERN_SCROLL) {
+      const size_t size = frame_bytes(ctx);
+      draw_bg_rows(ctx, ctx->scroll_buf, 0, height);
+      frame_copy(ctx->scroll_buf + size, ctx->scroll_buf, size, size);
+      ctx->scroll_y %= height;
+   } else {
+      draw_pattern_rows(ctx, 0, height);
+   }
+   overlay_invalidate(ctx);
+}
+
+static int64_t monotonic_usec(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void drift_meter_reset(struct avtest *ctx)
+{
+   memset(ctx->drift_windows, 0, sizeof(ctx->drift_windows));
+   memset(&ctx->drift_current, 0, sizeof(ctx->drift_current));
+   ctx->drift_window_head = 0;
+   ctx->drift_window_count = 0;
+   ctx->drift_window_start = 0;
+   ctx->drift_have_frametime = false;
+   ctx->drift_ppm_wall = 0.0;
+   ctx->drift_ppm_frametime = 0.0;
+}
+
+static void stats_reset(struct avtest *ctx)
+{
+   memset(&ctx->stats, 0, sizeof(ctx->stats));
+   ctx->stats.magic = STATS_MAGIC;
+   ctx->stats.version = STATS_VERSION;
+}
+
+/* Puts everything the frontend did not set back to its initial value */
+static void reset_state(struct avtest *ctx)
+{
+   const size_t keep = offsetof(struct avtest, base_directory);
+
+   memset((uint8_t *)ctx + keep, 0, sizeof(*ctx) - keep);
+   ctx->pixel_format = RETRO_PIXEL_FORMAT_XRGB8888;
+   ctx->frame_bpp = 4;
+   ctx->input_max_users = 1;
+   ctx->test_pattern = PATTERN_GRID;
+   ctx->audio_sample_rate = 48000.0;
+   ctx->audio_source_rate = 48000.0;
+   ctx->audio_rate_factor = 1;
+   ctx->audio_batch_size = 1;
+   ctx->audio_source = AUDIO_SOURCE_ALTERNATE;
+   stats_reset(ctx);
+}
+
+void avtest_audio_buffer_status(struct avtest *ctx, bool active, unsigned occupancy, bool underrun_likely)
+{
+   (void)active;
+   ctx->stats.audio_buffer_occupancy = occupancy;
+   if (underrun_likely)
+      ctx->stats.audio_underruns++;
+}
+
+void avtest_frame_time(struct avtest *ctx, retro_usec_t usec)
+{
+   unsigned bucket = usec > 0 ? (unsigned)(usec / 1000) : 0;
+
+   ctx->stats.frame_time_usec = usec > 0 ? (uint32_t)usec : 0;
+   ctx->stats.frame_time_hist[bucket < STATS_FRAME_TIME_BUCKETS ? bucket : STATS_FRAME_TIME_BUCKETS - 1]++;
+
+   if (!ctx->drift_meter_enabled)
+      return;
+
+   ctx->drift_current.frametime_usec += usec;
+   ctx->drift_have_frametime = true;
+}
+
+static double drift_ppm(struct avtest *ctx, uint64_t audio_frames, int64_t usec)
+{
+   if (usec <= 0 || ctx->audio_sample_rate <= 0.0)
+      return 0.0;
+
+   double nominal = ctx->audio_sample_rate * (double)usec / 1000000.0;
+   return ((double)audio_frames / nominal - 1.0) * 1000000.0;
+}
+
+static void drift_meter_update(struct avtest *ctx)
+{
+   int64_t now = monotonic_usec();
+
+   if (ctx->drift_window_start == 0) {
+      ctx->drift_window_start = now;
+      memset(&ctx->drift_current, 0, sizeof(ctx->drift_current));
+      return;
+   }
+
+   if (now - ctx->drift_window_start < DRIFT_WINDOW_USEC)
+      return;
+
+   ctx->drift_current.wall_usec = now - ctx->drift_window_start;
+   ctx->drift_windows[ctx->drift_window_head] = ctx->drift_current;
+   ctx->drift_window_head = (ctx->drift_window_head + 1) % DRIFT_WINDOWS;
+   if (ctx->drift_window_count < DRIFT_WINDOWS)
+      ctx->drift_window_count++;
+
+   memset(&ctx->drift_current, 0, sizeof(ctx->drift_current));
+   ctx->drift_window_start = now;
+
+   struct drift_window total = {0};
+   for (unsigned i = 0; i < ctx->drift_window_count; i++) {
+      total.wall_usec += ctx->drift_windows[i].wall_usec;
+      total.frametime_usec += ctx->drift_windows[i].frametime_usec;
+      total.audio_frames += ctx->drift_windows[i].audio_frames;
+   }
+
+   ctx->drift_ppm_wall = drift_ppm(ctx, total.audio_frames, total.wall_usec);
+   ctx->drift_ppm_frametime = drift_ppm(ctx, total.audio_frames, total.frametime_usec);
+
+   if (ctx->log_cb) {
+      if (ctx->drift_have_frametime)
+         ctx->log_cb(RETRO_LOG_INFO, "Audio drift over %us: %+.1f ppm (wall clock), %+.1f ppm (frame time).\n",
+                ctx->drift_window_count, ctx->drift_ppm_wall, ctx->drift_ppm_frametime);
+      else
+         ctx->log_cb(RETRO_LOG_INFO, "Audio drift over %us: %+.1f ppm (wall clock).\n",
+                ctx->drift_window_count, ctx->drift_ppm_wall);
+   }
+}
+
+static void toggle_drift_meter(struct avtest *ctx)
+{
+   ctx->drift_meter_enabled = !ctx->drift_meter_enabled;
+   drift_meter_reset(ctx);
+}
+
+static void build_glyph_atlas(struct avtest *ctx)
+{
+   const uint32_t fg = map_color(ctx, OVERLAY_FG);
+   const uint32_t bg = map_color(ctx, OVERLAY_BG);
+
+   for (unsigned g = 0; g < FONT8X8_NUM_GLYPHS; g++) {
+      for (unsigned y = 0; y < 8; y++) {
+         uint8_t bits = ctx->assets[ASSET_FONT].data[g * 8 + y];
+         for (unsigned x = 0; x < 8; x++)
+            store_pixel(ctx, &ctx->glyph_atlas[g][(y * 8 + x) * ctx->frame_bpp], (bits & (1 << x)) ? fg : bg);
+      }
+   }
+   ctx->glyph_atlas_ready = true;
+}
+
+static void overlay_draw_line(struct avtest *ctx, unsigned line, const char *text)
+{
+   const size_t pitch = frame_pitch(ctx);
+   uint8_t *dst = ctx->frame_buf + (OVERLAY_Y + line * 8) * pitch + OVERLAY_X * ctx->frame_bpp;
+
+   for (unsigned col = 0; col < OVERLAY_COLS; col++, dst += 8 * ctx->frame_bpp) {
+      unsigned c = (unsigned char)text[col];
+      if (c >= 'a' && c <= 'z')
+         c -= 'a' - 'A';
+      if (c < FONT8X8_FIRST_CHAR || c >= FONT8X8_FIRST_CHAR + FONT8X8_NUM_GLYPHS)
+         c = ' ';
+
+      const uint8_t *glyph = ctx->glyph_atlas[c - FONT8X8_FIRST_CHAR];
+      for (unsigned y = 0; y < 8; y++)
+         memcpy(dst + y * pitch, glyph + y * 8 * ctx->frame_bpp, 8 * ctx->frame_bpp);
+   }
+}
+
+static void overlay_update_fps(struct avtest *ctx)
+{
+   int64_t now = monotonic_usec();
+
+   if (ctx->fps_window_start == 0) {
+      ctx->fps_window_start = now;
+      ctx->fps_window_frames = 0;
+      return;
+   }
+
+   /* A new rate starts the count again */
+   if (ctx->overlay_drift_start == 0 || ctx->overlay_drift_rate != ctx->audio_sample_rate) {
+      ctx->overlay_drift_start = now;
+      ctx->overlay_drift_frames = ctx->stats.audio_frames;
+      ctx->overlay_drift_rate = ctx->audio_sample_rate;
+      ctx->overlay_drift_valid = false;
+   }
+
+   ctx->fps_window_frames++;
+   if (now - ctx->fps_window_start >= 1000000) {
+      ctx->measured_fps = ctx->fps_window_frames * 1000000.0 / (double)(now - ctx->fps_window_start);
+      ctx->fps_window_start = now;
+      ctx->fps_window_frames = 0;
+
+      const double expected = ctx->overlay_drift_rate * (double)(now - ctx->overlay_drift_start) / 1000000.0;
+      ctx->overlay_drift = (int64_t)(ctx->stats.audio_frames - ctx->overlay_drift_frames) - (int64_t)(expected + 0.5);
+      ctx->overlay_drift_valid = true;
+   }
 }
 
-void load_bg(bool is_50) 
+static void overlay_render(struct avtest *ctx)
 {
-   free(frame_buf);
+   char lines[OVERLAY_LINES][OVERLAY_COLS + 1];
+   const char *audio_mode = ctx->audio_use_stereo ? "STEREO" :
+                            ctx->audio_sequential ? "L/R SEQ" : "MONO";
+
+   snprintf(lines[0], sizeof(lines[0]), "FPS %6.2f %s",
+            ctx->measured_fps, ctx->is_50hz ? "50HZ" : "60HZ");
+   snprintf(lines[1], sizeof(lines[1]), "AUDIO %u/FRAME",
+            (unsigned)ctx->last_audio_frames);
+   snprintf(lines[2], sizeof(lines[2]), "%s %s",
+            ctx->audio_paused ? "PAUSED" : "PLAYING", audio_mode);
+   if (ctx->overlay_drift_valid)
+      snprintf(lines[3], sizeof(lines[3]), "DRIFT %+lld SMP", (long long)ctx->overlay_drift);
+   else
+      snprintf(lines[3], sizeof(lines[3]), "DRIFT ---");
+   /* Audio clock drift, measured by the drift meter */
+   if (!ctx->drift_meter_enabled)
+      lines[4][0] = '\0';
+   else if (ctx->drift_window_count == 0)
+      snprintf(lines[4], sizeof(lines[4]), "PPM ---");
+   else if (ctx->drift_have_frametime)
+      snprintf(lines[4], sizeof(lines[4]), "PPM W%+.0f F%+.0f",
+               ctx->drift_ppm_wall, ctx->drift_ppm_frametime);
+   else
+      snprintf(lines[4], sizeof(lines[4]), "PPM W%+.0f", ctx->drift_ppm_wall);
 
-   const uint8_t *data = is_50 ? grid_50_bin : grid_60_bin;
-   const unsigned width = FRAME_BUF_WIDTH;
-   const unsigned height = is_50 ? FRAME_BUF_HEIGHT_PAL : FRAME_BUF_HEIGHT_NTSC;
+   for (unsigned i = 0; i < OVERLAY_LINES; i++) {
+      size_t len = strlen(lines[i]);
+      memset(lines[i] + len, ' ', OVERLAY_COLS - len);
 
-   frame_buf = malloc(width * FRAME_BUF_MAX_HEIGHT * sizeof(uint32_t));
+      if (memcmp(ctx->overlay_drawn[i], lines[i], OVERLAY_COLS) == 0)
+         continue;
 
-   for(unsigned i = 0; i < width * height; i++) {
-      uint8_t r = data[i*3 + 0];
-      uint8_t g = data[i*3 + 1];
-      uint8_t b = data[i*3 + 2];
-      frame_buf[i] = (r << 16) | (g << 8) | b;
+      overlay_draw_line(ctx, i, lines[i]);
+      memcpy(ctx->overlay_drawn[i], lines[i], OVERLAY_COLS);
    }
 }
 
+/* Draws the video marker over the bottom rows of frame. Every cell is
+ * written, so the next marker covers this one completely. */
+static void marker_draw(struct avtest *ctx, uint8_t *frame, unsigned height, size_t pitch)
+{
+   const uint32_t white = map_color(ctx, 0x00FFFFFF);
+   const uint32_t black = map_color(ctx, 0x00000000);
+   const size_t bytes = MARKER_CELLS * MARKER_CELL * ctx->frame_bpp;
+   uint8_t *rows = frame + (height - MARKER_CELL) * pitch;
+   unsigned parity = 0;
+
+   for (unsigned cell = 0; cell < MARKER_CELLS; cell++) {
+      bool bit;
+
+      if (cell == 0) {
+         bit = true;
+      } else if (cell <= MARKER_BITS) {
+         bit = (ctx->stats.frames >> (MARKER_BITS - cell)) & 1;
+         parity ^= bit;
+      } else {
+         bit = parity;
+      }
+
+      for (unsigned x = 0; x < MARKER_CELL; x++)
+         store_pixel(ctx, rows + (cell * MARKER_CELL + x) * ctx->frame_bpp, bit ? white : black);
+   }
+
+   for (unsigned y = 1; y < MARKER_CELL; y++)
+      memcpy(rows + y * pitch, rows, bytes);
+}
+
+static void toggle_overlay(struct avtest *ctx)
+{
+   ctx->overlay_enabled = !ctx->overlay_enabled;
+   overlay_invalidate(ctx);
+
+   if (ctx->overlay_enabled) {
+      if (!ctx->glyph_atlas_ready)
+         build_glyph_atlas(ctx);
+      ctx->fps_window_start = 0;
+      ctx->overlay_drift_start = 0;
+   } else {
+      draw_pattern_rows(ctx, OVERLAY_Y, OVERLAY_LINES * 8);
+   }
+}
+
+static void set_pixel_format(struct avtest *ctx, enum retro_pixel_format fmt)
+{
+   ctx->pixel_format = fmt;
+   ctx->frame_bpp = fmt == RETRO_PIXEL_FORMAT_RGB565 ? 2 : 4;
+   ctx->glyph_atlas_ready = false;
+   if (ctx->overlay_enabled)
+      build_glyph_atlas(ctx);
+   load_bg(ctx);
+}
+
+/* The noise pattern asks the frontend to fast-forward without a cap, so
+ * the frames it ran while the pattern was up give the most the video
+ * path sustains. */
+static void noise_begin(struct avtest *ctx)
+{
+   struct retro_fastforwarding_override ff = { 0.0f, true, false, true };
+
+   for (unsigned i = 0; i < NOISE_LANES; i++)
+      ctx->noise_state[i] = 0x9E3779B9u * (i + 1);
+   ctx->noise_frames = 0;
+   ctx->noise_start_usec = monotonic_usec();
+
+   if (!ctx->environ_cb(RETRO_ENVIRONMENT_SET_FASTFORWARDING_OVERRIDE, &ff) && ctx->log_cb)
+      ctx->log_cb(RETRO_LOG_WARN, "Frontend cannot run unthrottled, noise runs at the normal rate.\n");
+}
+
+static void noise_end(struct avtest *ctx)
+{
+   struct retro_fastforwarding_override ff = { 0.0f, false, false, false };
+   const double seconds = (double)(monotonic_usec() - ctx->noise_start_usec) / 1000000.0;
+
+   ctx->environ_cb(RETRO_ENVIRONMENT_SET_FASTFORWARDING_OVERRIDE, &ff);
+   if (ctx->log_cb && ctx->noise_frames && seconds > 0.0)
+      ctx->log_cb(RETRO_LOG_INFO, "Noise: %u frames in %.2f s, %.1f fps.\n",
+             ctx->noise_frames, seconds, ctx->noise_frames / seconds);
+}
+
+static void set_test_pattern(struct avtest *ctx, enum test_pattern pattern)
+{
+   if (ctx->test_pattern == PATTERN_NOISE)
+      noise_end(ctx);
+
+   ctx->test_pattern = pattern;
+   ctx->bar_x = 0;
+   ctx->scroll_y = 0;
+
+   if (ctx->test_pattern == PATTERN_NOISE)
+      noise_begin(ctx);
+}
+
+static void cycle_test_pattern(struct avtest *ctx)
+{
+   set_test_pattern(ctx, (enum test_pattern)((ctx->test_pattern + 1) % PATTERN_COUNT));
+   load_bg(ctx);
+}
+
+/* Brightness and color tests only swap the palette, so the indexed
+ * patterns are re-expanded with it. */
+static void cycle_palette(struct avtest *ctx)
+{
+   ctx->palette_mode = (ctx->palette_mode + 1) % PALETTE_MODES;
+   if (ctx->test_pattern != PATTERN_MOVING_BAR && ctx->test_pattern != PATTERN_NOISE)
+      load_bg(ctx);
+}
+
 /* Tell the frontend each time you toggle */
-static void push_geometry(void)
+static void push_geometry(struct avtest *ctx)
 {
     struct retro_game_geometry geom = {
-        FRAME_BUF_WIDTH,
-        is_50hz ? FRAME_BUF_HEIGHT_PAL : FRAME_BUF_HEIGHT_NTSC,
-        FRAME_BUF_WIDTH,
-        FRAME_BUF_MAX_HEIGHT,          /* still 288 */
-        (float)FRAME_BUF_WIDTH /
-        (float)(is_50hz ? FRAME_BUF_HEIGHT_PAL : FRAME_BUF_HEIGHT_NTSC)
+        frame_width(ctx),
+        frame_height(ctx),
+        FRAME_BUF_MAX_WIDTH,
+        FRAME_BUF_MAX_HEIGHT,
+        (float)frame_width(ctx) / (float)frame_height(ctx)
     };
-    environ_cb(RETRO_ENVIRONMENT_SET_GEOMETRY, &geom);
+    ctx->environ_cb(RETRO_ENVIRONMENT_SET_GEOMETRY, &geom);
 }
 
-static void toggle_video_mode(void)
+/* The frontend reports this period when it fakes the frame time, e.g.
+ * while fast-forwarding, so it has to follow the refresh rate. */
+static void register_frame_time(struct avtest *ctx)
 {
-    is_50hz = !is_50hz;
-    audio_frame_accum = 0.0;
-    push_geometry();                   /* ① resize agreement          */
+    if (!ctx->frame_time_cb)
+       return;
 
+    struct retro_frame_time_callback frame_time = { ctx->frame_time_cb, 1000000 / (ctx->is_50hz ? 50 : 60) };
+    ctx->environ_cb(RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK, &frame_time);
+}
+
+/* New timing or audio rate. The frontend reinitializes its audio and
+ * video drivers for this, so it is only sent when one of them changed;
+ * the geometry travels with it. */
+static void push_av_info(struct avtest *ctx)
+{
     struct retro_system_av_info av;
-    retro_get_system_av_info(&av);     /* ② (optional) real refresh   */
-    environ_cb(RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO, &av);
+    avtest_get_system_av_info(ctx, &av);
+    ctx->environ_cb(RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO, &av);
+    register_frame_time(ctx);
+}
+
+static void toggle_video_mode(struct avtest *ctx)
+{
+    const unsigned height = frame_height(ctx);
+
+    ctx->is_50hz = !ctx->is_50hz;
+    ctx->audio_frame_accum = 0.0;
+    push_av_info(ctx);
+
+    if (frame_height(ctx) != height)
+       load_bg(ctx);
+}
+
+/* avtest_resolution values other than auto */
+static const struct resolution {
+   const char *value;
+   unsigned width;
+   unsigned height;
+} resolutions[] = {
+   { "320x240",   FRAME_BUF_WIDTH, FRAME_BUF_HEIGHT_NTSC },
+   { "320x288",   FRAME_BUF_WIDTH, FRAME_BUF_HEIGHT_PAL },
+   { "640x480",   640,  480 },
+   { "1280x720",  1280, 720 },
+   { "1920x1080", 1920, 1080 },
+};
 
-    load_bg(is_50hz);                  /* ③ redraw                    */
+static struct retro_core_option_v2_definition option_definitions[] = {
+   {
+      "avtest_refresh", "Refresh Rate", NULL,
+      "Frame rate of the core. A and B switch it as well.", NULL, NULL,
+      { { "60", "60 Hz" }, { "50", "50 Hz" }, { NULL, NULL } },
+      "60"
+   },
+   {
+      "avtest_resolution", "Resolution", NULL,
+      "Output size. Auto is 320x240 at 60 Hz and 320x288 at 50 Hz; the larger sizes stress the frontend's upload and scaling.", NULL, NULL,
+      {
+         { "auto", "Auto" },
+         { "320x240", NULL },
+         { "320x288", NULL },
+         { "640x480", NULL },
+         { "1280x720", NULL },
+         { "1920x1080", NULL },
+         { NULL, NULL },
+      },
+      "auto"
+   },
+   {
+      "avtest_pixel_format", "Pixel Format", NULL,
+      "Output pixel format, if the frontend supports it. Takes effect when content is loaded.", NULL, NULL,
+      { { "xrgb8888", "XRGB8888" }, { "rgb565", "RGB565" }, { NULL, NULL } },
+      "xrgb8888"
+   },
+   {
+      "avtest_audio_source", "Audio Source", NULL,
+      "Channels the mono test WAVs play on. Alternate plays the left WAV on the left channel, "
+      "then the right WAV on the right channel. Mix plays both WAVs on their own channels with "
+      "a 1 kHz tone at -20 dBFS and a sync click every second. Stereo WAVs always play as they are.", NULL, NULL,
+      {
+         { "alternate", "Alternate Left/Right" },
+         { "both", "Both at Once" },
+         { "left", "Left Only" },
+         { "right", "Right Only" },
+         { "mix", "Mix with Tone and Clicks" },
+         { NULL, NULL },
+      },
+      "alternate"
+   },
+   {
+      "avtest_audio_rate", "Audio Sample Rate", NULL,
+      "Output rate. The higher rates repeat every WAV sample, to load the frontend's resampler.", NULL, NULL,
+      { { "wav", "WAV Rate" }, { "96000", "96 kHz" }, { "192000", "192 kHz" }, { NULL, NULL } },
+      "wav"
+   },
+   {
+      "avtest_audio_batch", "Audio Batch Size", NULL,
+      "Video frames of audio per audio batch. Bigger batches arrive in bursts on every Nth frame.", NULL, NULL,
+      { { "1", "1 Frame" }, { "2", "2 Frames" }, { "4", "4 Frames" }, { "8", "8 Frames" }, { NULL, NULL } },
+      "1"
+   },
+   {
+      "avtest_markers", "Frame Markers", NULL,
+      "Frame counter as a barcode at the bottom left and as a low-level code at the start of every audio batch, for matching captures to core frames.", NULL, NULL,
+      { { "off", "Off" }, { "on", "On" }, { NULL, NULL } },
+      "off"
+   },
+   {
+      "avtest_pattern", "Test Pattern", NULL,
+      "Initial test pattern. X cycles through the patterns as well.", NULL, NULL,
+      {
+         { "grid", "Grid" },
+         { "moving_bar", "Moving Bar" },
+         { "scroll", "Scrolling Grid" },
+         { "smpte_bars", "SMPTE Color Bars" },
+         { "ebu_bars", "EBU Color Bars" },
+         { "gray_ramp", "Grayscale Ramp" },
+         { "gamma_ramp", "Gamma Ramp" },
+         { "pluge", "PLUGE" },
+         { "checkerboard", "Checkerboard" },
+         { "crosshatch", "Convergence Crosshatch" },
+         { "noise", "Noise (Unthrottled Benchmark)" },
+         { NULL, NULL },
+      },
+      "grid"
+   },
+   { NULL, NULL, NULL, NULL, NULL, NULL, { { NULL, NULL } }, NULL },
+};
+
+static struct retro_core_options_v2 options_v2 = { NULL, option_definitions };
+
+static const char *get_option(struct avtest *ctx, const char *key)
+{
+   struct retro_variable var = { key, NULL };
+
+   if (ctx->environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      return var.value;
+   return "";
+}
+
+static void read_options(struct avtest *ctx, struct core_options *opt)
+{
+   const char *value;
+
+   opt->is_50hz = strcmp(get_option(ctx, "avtest_refresh"), "50") == 0;
+   opt->markers = strcmp(get_option(ctx, "avtest_markers"), "on") == 0;
+
+   value = get_option(ctx, "avtest_resolution");
+   opt->resolution_width = 0;
+   opt->resolution_height = 0;
+   for (size_t i = 0; i < sizeof(resolutions) / sizeof(resolutions[0]); i++) {
+      if (strcmp(value, resolutions[i].value) == 0) {
+         opt->resolution_width = resolutions[i].width;
+         opt->resolution_height = resolutions[i].height;
+      }
+   }
+
+   opt->pixel_format = strcmp(get_option(ctx, "avtest_pixel_format"), "rgb565") == 0
+                       ? RETRO_PIXEL_FORMAT_RGB565 : RETRO_PIXEL_FORMAT_XRGB8888;
+
+   value = get_option(ctx, "avtest_audio_source");
+   if (strcmp(value, "both") == 0)
+      opt->audio_source = AUDIO_SOURCE_BOTH;
+   else if (strcmp(value, "left") == 0)
+      opt->audio_source = AUDIO_SOURCE_LEFT;
+   else if (strcmp(value, "right") == 0)
+      opt->audio_source = AUDIO_SOURCE_RIGHT;
+   else if (strcmp(value, "mix") == 0)
+      opt->audio_source = AUDIO_SOURCE_MIX;
+   else
+      opt->audio_source = AUDIO_SOURCE_ALTERNATE;
+
+   opt->audio_rate = (unsigned)strtoul(get_option(ctx, "avtest_audio_rate"), NULL, 10);
+   if (opt->audio_rate > AUDIO_MAX_STRESS_RATE)
+      opt->audio_rate = AUDIO_MAX_STRESS_RATE;
+
+   opt->audio_batch = (unsigned)strtoul(get_option(ctx, "avtest_audio_batch"), NULL, 10);
+   if (opt->audio_batch < 1)
+      opt->audio_batch = 1;
+   else if (opt->audio_batch > AUDIO_MAX_BATCH)
+      opt->audio_batch = AUDIO_MAX_BATCH;
+
+   value = get_option(ctx, "avtest_pattern");
+   opt->test_pattern = PATTERN_GRID;
+   for (unsigned i = 0; i < PATTERN_COUNT; i++) {
+      if (strcmp(value, pattern_keys[i]) == 0)
+         opt->test_pattern = (enum test_pattern)i;
+   }
 }
 
-static void check_variables(void)
+/* Applies the options that changed since they were last read. Options
+ * whose value the buttons already selected change nothing. Only new
+ * timing reaches the frontend as SET_SYSTEM_AV_INFO; a new size alone
+ * is a cheap SET_GEOMETRY. */
+static void check_variables(struct avtest *ctx)
 {
-   log_cb(RETRO_LOG_INFO, "Variable updated\n");
+   struct core_options next;
+   const unsigned width = frame_width(ctx);
+   const unsigned height = frame_height(ctx);
+   bool resized;
+   bool av_changed = false;
+   bool redraw = false;
+
+   read_options(ctx, &next);
+
+   if (next.is_50hz != ctx->options.is_50hz && next.is_50hz != ctx->is_50hz) {
+      ctx->is_50hz = next.is_50hz;
+      ctx->audio_frame_accum = 0.0;
+      av_changed = true;
+   }
+
+   if (next.resolution_width != ctx->options.resolution_width ||
+       next.resolution_height != ctx->options.resolution_height) {
+      ctx->resolution_width = next.resolution_width;
+      ctx->resolution_height = next.resolution_height;
+   }
+
+   /* SET_PIXEL_FORMAT is only allowed while loading */
+   if (next.pixel_format != ctx->options.pixel_format && ctx->log_cb)
+      ctx->log_cb(RETRO_LOG_INFO, "The pixel format changes when content is loaded again.\n");
 
-   free(frame_buf);
-   load_bg(false);
+   if (next.audio_source != ctx->options.audio_source || next.audio_rate != ctx->options.audio_rate) {
+      const double rate = ctx->audio_sample_rate;
+
+      ctx->audio_source = next.audio_source;
+      ctx->audio_stress_rate = next.audio_rate;
+      audio_init(ctx);
+      if (ctx->audio_sample_rate != rate)
+         av_changed = true;
+   }
+
+   if (next.audio_batch != ctx->options.audio_batch) {
+      ctx->audio_batch_size = next.audio_batch;
+      ctx->audio_batch_pending = 0;
+   }
 
-   struct retro_system_av_info av_info;
-   retro_get_system_av_info(&av_info);
-   environ_cb(RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO, &av_info);
+   if (next.test_pattern != ctx->options.test_pattern && next.test_pattern != ctx->test_pattern) {
+      set_test_pattern(ctx, next.test_pattern);
+      redraw = true;
+   }
+
+   /* the last marker is part of the background until it is redrawn */
+   if (ctx->markers_enabled && !next.markers)
+      redraw = true;
+   ctx->markers_enabled = next.markers;
+
+   ctx->options = next;
+   resized = frame_width(ctx) != width || frame_height(ctx) != height;
+
+   if (av_changed)
+      push_av_info(ctx);
+   else if (resized)
+      push_geometry(ctx);
+
+   if (redraw || resized)
+      load_bg(ctx);
 }
 
-static void update_input(void)
+static void toggle_audio_pause(struct avtest *ctx)
 {
-   if (input_poll_cb)
-      input_poll_cb();
+   ctx->audio_paused = !ctx->audio_paused;
+}
 
-   // Check if A or B button are pressed
-   int16_t input_a = input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_A);
-   int16_t input_b = input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_B);
-   int16_t input_start = input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_START);
+/* Buttons are matched on any port; an action fires once per new press of
+ * any button in its mask. */
+struct button_action {
+   uint16_t mask;
+   void (*action)(struct avtest *ctx);
+};
 
-   if ((input_a && !prev_a_pressed) || (input_b && !prev_b_pressed))
-      toggle_video_mode();
+static const struct button_action button_actions[] = {
+   { BUTTON(RETRO_DEVICE_ID_JOYPAD_A) | BUTTON(RETRO_DEVICE_ID_JOYPAD_B), toggle_video_mode },
+   { BUTTON(RETRO_DEVICE_ID_JOYPAD_START), toggle_audio_pause },
+   { BUTTON(RETRO_DEVICE_ID_JOYPAD_Y), toggle_overlay },
+   { BUTTON(RETRO_DEVICE_ID_JOYPAD_X), cycle_test_pattern },
+   { BUTTON(RETRO_DEVICE_ID_JOYPAD_L), toggle_drift_meter },
+   { BUTTON(RETRO_DEVICE_ID_JOYPAD_R), cycle_palette },
+};
+
+/* Every button in button_actions, the only ones worth querying */
+#define ACTION_BUTTONS (BUTTON(RETRO_DEVICE_ID_JOYPAD_A) | BUTTON(RETRO_DEVICE_ID_JOYPAD_B) | \
+                        BUTTON(RETRO_DEVICE_ID_JOYPAD_START) | BUTTON(RETRO_DEVICE_ID_JOYPAD_Y) | \
+                        BUTTON(RETRO_DEVICE_ID_JOYPAD_X) | BUTTON(RETRO_DEVICE_ID_JOYPAD_L) | \
+                        BUTTON(RETRO_DEVICE_ID_JOYPAD_R))
 
-   if (input_start && !prev_start_pressed)
-      audio_paused = !audio_paused;
+static uint16_t read_buttons(struct avtest *ctx, unsigned port)
+{
+   if (ctx->input_bitmasks)
+      return (uint16_t)ctx->input_state_cb(port, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_MASK);
 
-   // Update the previous state of the A and B buttons
-   prev_a_pressed = input_a != 0;
-   prev_b_pressed = input_b != 0;
-   prev_start_pressed = input_start != 0;
+   uint16_t buttons = 0;
+   for (unsigned id = 0; id < JOYPAD_BUTTONS; id++) {
+      if ((ACTION_BUTTONS & BUTTON(id)) && ctx->input_state_cb(port, RETRO_DEVICE_JOYPAD, 0, id))
+         buttons |= BUTTON(id);
+   }
+   return buttons;
 }
 
-void retro_init(void)
+static void update_input(struct avtest *ctx)
 {
-   load_bg(false);
-   push_geometry();
-   audio_init();
+   if (ctx->input_poll_cb)
+      ctx->input_poll_cb();
+
+   uint16_t pressed = 0;
+
+   for (unsigned port = 0; port < ctx->input_max_users; port++) {
+      uint16_t buttons = read_buttons(ctx, port) & ACTION_BUTTONS;
+      pressed |= buttons & ~ctx->prev_buttons[port];
+      ctx->prev_buttons[port] = buttons;
+   }
+
+   if (!pressed)
+      return;
+
+   for (size_t i = 0; i < sizeof(button_actions) / sizeof(button_actions[0]); i++) {
+      if (pressed & button_actions[i].mask)
+         button_actions[i].action(ctx);
+   }
+}
+
+void avtest_init(struct avtest *ctx)
+{
+   kernels_init();
+   reset_state(ctx);
+   if (ctx->log_cb)
+      ctx->log_cb(RETRO_LOG_INFO, "Using %s kernels.\n", kernels.name);
 
    const char *dir = NULL;
-   if (environ_cb(RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY, &dir) && dir)
+   if (ctx->environ_cb(RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY, &dir) && dir)
    {
-      snprintf(retro_base_directory, sizeof(retro_base_directory), "%s", dir);
+      snprintf(ctx->base_directory, sizeof(ctx->base_directory), "%s", dir);
+   }
+   load_assets(ctx);
+
+   /* Largest mode and format, as the resolution option can change
+    * inside retro_run(), which must not allocate. The pitch is a
+    * multiple of the alignment. */
+   ctx->frame_buf = aligned_alloc(FRAME_PITCH_ALIGN, FRAME_BUF_MAX_WIDTH * FRAME_BUF_MAX_HEIGHT * sizeof(uint32_t));
+   ctx->scroll_buf = aligned_alloc(FRAME_PITCH_ALIGN, FRAME_BUF_MAX_WIDTH * FRAME_BUF_MAX_HEIGHT * 2 * sizeof(uint32_t));
+   if (!ctx->frame_buf || !ctx->scroll_buf) {
+      free(ctx->frame_buf);
+      free(ctx->scroll_buf);
+      ctx->frame_buf = NULL;
+      ctx->scroll_buf = NULL;
+      if (ctx->log_cb)
+         ctx->log_cb(RETRO_LOG_ERROR, "Out of memory for the frame buffers.\n");
    }
+   load_bg(ctx);
+   audio_init(ctx);
+
+   unsigned max_users = 0;
+   if (ctx->environ_cb(RETRO_ENVIRONMENT_GET_INPUT_MAX_USERS, &max_users) && max_users > 0)
+      ctx->input_max_users = max_users < MAX_INPUT_PORTS ? max_users : MAX_INPUT_PORTS;
 }
 
-void retro_deinit(void)
+void avtest_deinit(struct avtest *ctx)
 {
-   free(frame_buf);
-   frame_buf = NULL;
-   free(audio_buf);
-   audio_buf = NULL;
-   audio_buf_frames = 0;
-   is_50hz = false;
-   prev_a_pressed = false;
-   prev_b_pressed = false;
-   prev_start_pressed = false;
-   audio_paused = false;
-   audio_ready = false;
-   audio_use_stereo = false;
-   audio_has_right = false;
-   audio_sequential = false;
-   audio_play_right = false;
-   audio_sample_rate = 48000.0;
-   audio_frame_accum = 0.0;
-   left_pos = 0;
-   right_pos = 0;
-   stereo_pos = 0;
+   pack_close(&ctx->pack);
+   free(ctx->frame_buf);
+   free(ctx->scroll_buf);
+   free(ctx->audio_buf);
+   free(ctx->audio_src_buf);
+   reset_state(ctx);
 }
 
 unsigned retro_api_version(void)
@@ -461,7 +1761,8 @@ unsigned retro_api_version(void)
 
 void retro_set_controller_port_device(unsigned port, unsigned device)
 {
-   log_cb(RETRO_LOG_INFO, "Plugging device %u into port %u.\n", device, port);
+   if (core.log_cb)
+      core.log_cb(RETRO_LOG_INFO, "Plugging device %u into port %u.\n", device, port);
 }
 
 void retro_get_system_info(struct retro_system_info *info)
@@ -473,35 +1774,49 @@ void retro_get_system_info(struct retro_system_info *info)
    info->valid_extensions = "";
 }
 
-void retro_get_system_av_info(struct retro_system_av_info *info)
+void avtest_get_system_av_info(struct avtest *ctx, struct retro_system_av_info *info)
 {
-    info->timing.sample_rate = (float)audio_sample_rate;
-    info->timing.fps         = is_50hz ? 50.0f : 60.0f;
+    info->timing.sample_rate = (float)ctx->audio_sample_rate;
+    info->timing.fps         = ctx->is_50hz ? 50.0f : 60.0f;
 
-    info->geometry.base_width   = FRAME_BUF_WIDTH;
-    info->geometry.base_height  = is_50hz ? FRAME_BUF_HEIGHT_PAL   /* 288 */
-                                          : FRAME_BUF_HEIGHT_NTSC; /* 240 */
-    info->geometry.max_width    = FRAME_BUF_WIDTH;
-    info->geometry.max_height   = FRAME_BUF_MAX_HEIGHT;            /* **288** no matter what */
+    info->geometry.base_width   = frame_width(ctx);
+    info->geometry.base_height  = frame_height(ctx);
+    info->geometry.max_width    = FRAME_BUF_MAX_WIDTH;
+    info->geometry.max_height   = FRAME_BUF_MAX_HEIGHT;
     info->geometry.aspect_ratio = (float)info->geometry.base_width /
                                   (float)info->geometry.base_height;
 }
 
-void retro_set_environment(retro_environment_t cb)
+void avtest_set_environment(struct avtest *ctx, retro_environment_t cb)
 {
-   environ_cb = cb;
+   ctx->environ_cb = cb;
 
    struct retro_log_callback logging;
-   if (environ_cb(RETRO_ENVIRONMENT_GET_LOG_INTERFACE, &logging))
+   if (ctx->environ_cb(RETRO_ENVIRONMENT_GET_LOG_INTERFACE, &logging))
    {
-      log_cb = logging.log;
+      ctx->log_cb = logging.log;
    }
 
+   ctx->input_bitmasks = ctx->environ_cb(RETRO_ENVIRONMENT_GET_INPUT_BITMASKS, NULL);
+
+   unsigned options_version = 0;
+   if (ctx->environ_cb(RETRO_ENVIRONMENT_GET_CORE_OPTIONS_VERSION, &options_version) && options_version >= 2)
+      ctx->environ_cb(RETRO_ENVIRONMENT_SET_CORE_OPTIONS_V2, &options_v2);
+   else if (ctx->log_cb)
+      ctx->log_cb(RETRO_LOG_WARN, "Frontend lacks core options v2, using the default options.\n");
+
    static const struct retro_controller_description controllers[] = {
       { "Retropad", RETRO_DEVICE_SUBCLASS(RETRO_DEVICE_JOYPAD, 0) },
    };
 
    static const struct retro_controller_info ports[] = {
+      { controllers, 1 },
+      { controllers, 1 },
+      { controllers, 1 },
+      { controllers, 1 },
+      { controllers, 1 },
+      { controllers, 1 },
+      { controllers, 1 },
       { controllers, 1 },
       { NULL, 0 },
    };
@@ -509,84 +1824,158 @@ void retro_set_environment(retro_environment_t cb)
    cb(RETRO_ENVIRONMENT_SET_CONTROLLER_INFO, (void*)ports);
 }
 
-void retro_set_audio_sample(retro_audio_sample_t cb)
+void avtest_set_audio_sample(struct avtest *ctx, retro_audio_sample_t cb)
 {
-   audio_cb = cb;
+   ctx->audio_cb = cb;
 }
 
-void retro_set_audio_sample_batch(retro_audio_sample_batch_t cb)
+void avtest_set_audio_sample_batch(struct avtest *ctx, retro_audio_sample_batch_t cb)
 {
-   audio_batch_cb = cb;
+   ctx->audio_batch_cb = cb;
 }
 
-void retro_set_input_poll(retro_input_poll_t cb)
+void avtest_set_input_poll(struct avtest *ctx, retro_input_poll_t cb)
 {
-   input_poll_cb = cb;
+   ctx->input_poll_cb = cb;
 }
 
-void retro_set_input_state(retro_input_state_t cb)
+void avtest_set_input_state(struct avtest *ctx, retro_input_state_t cb)
 {
-   input_state_cb = cb;
+   ctx->input_state_cb = cb;
 }
 
-void retro_set_video_refresh(retro_video_refresh_t cb)
+void avtest_set_video_refresh(struct avtest *ctx, retro_video_refresh_t cb)
 {
-   video_cb = cb;
+   ctx->video_cb = cb;
 }
 
 void retro_reset(void)
 {
 }
 
-void retro_run(void)
+void avtest_run(struct avtest *ctx)
 {
-   update_input();
+   update_input(ctx);
 
    bool updated = false;
 
-   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated) && updated) {
-      check_variables();
+   if (ctx->environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated) && updated) {
+      check_variables(ctx);
+   }
+
+   const unsigned width = frame_width(ctx);
+   const unsigned height = frame_height(ctx);
+   const size_t pitch = frame_pitch(ctx);
+   const uint8_t *frame = ctx->frame_buf;
+
+   /* Scrolling only moves the pointer handed to the frontend */
+   if (ctx->test_pattern == PATTERN_MOVING_BAR) {
+      advance_moving_bar(ctx);
+   } else if (ctx->test_pattern == PATTERN_SCROLL) {
+      frame = ctx->scroll_buf + ctx->scroll_y * pitch;
+      ctx->scroll_y = (ctx->scroll_y + SCROLL_SPEED) % height;
+   } else if (ctx->test_pattern == PATTERN_NOISE) {
+      kernels.noise_fill(ctx->frame_buf, height * pitch, ctx->noise_state);
+      ctx->noise_frames++;
+      overlay_invalidate(ctx);
    }
 
-   unsigned pitch = FRAME_BUF_WIDTH * sizeof(uint32_t); // 4 bytes per pixel
+   /* The frontend may keep the frame it was given, so text and markers
+    * go on a copy of the scrolling window and stay there */
+   if ((ctx->overlay_enabled || ctx->markers_enabled) && frame != ctx->frame_buf) {
+      frame_copy(ctx->frame_buf, frame, height * pitch, height * pitch);
+      overlay_invalidate(ctx);
+      frame = ctx->frame_buf;
+   }
 
-   if (is_50hz)
-      video_cb(frame_buf, FRAME_BUF_WIDTH, FRAME_BUF_HEIGHT_PAL, pitch);
-   else
-      video_cb(frame_buf, FRAME_BUF_WIDTH, FRAME_BUF_HEIGHT_NTSC, pitch);
+   if (ctx->overlay_enabled) {
+      overlay_update_fps(ctx);
+      overlay_render(ctx);
+   }
+
+   if (ctx->markers_enabled)
+      marker_draw(ctx, ctx->frame_buf, height, pitch);
+
+   ctx->video_cb(frame, width, height, pitch);
+
+   render_audio(ctx);
 
-   render_audio();
+   if (ctx->drift_meter_enabled)
+      drift_meter_update(ctx);
+
+   ctx->stats.frames++;
 }
 
-bool retro_load_game(const struct retro_game_info *info)
+bool avtest_load_game(struct avtest *ctx, const struct retro_game_info *info)
 {
    static struct retro_input_descriptor desc[] = {
       { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_A, "A - Switch 50/60Hz" },
       { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_B, "B - Switch 50/60Hz" },
       { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_START, "Start - Pause/Resume Audio" },
+      { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_Y, "Y - Toggle Statistics Overlay" },
+      { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_X, "X - Next Test Pattern" },
+      { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_L, "L - Toggle Audio Drift Meter" },
+      { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_R, "R - Next Brightness/Color Test" },
       { 0 },
    };
 
-   environ_cb(RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS, desc);
+   /* avtest_init() could not allocate them */
+   if (!ctx->frame_buf)
+      return false;
+
+   ctx->environ_cb(RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS, desc);
+
+   read_options(ctx, &ctx->options);
+   ctx->is_50hz = ctx->options.is_50hz;
+   ctx->markers_enabled = ctx->options.markers;
+   ctx->resolution_width = ctx->options.resolution_width;
+   ctx->resolution_height = ctx->options.resolution_height;
+   set_test_pattern(ctx, ctx->options.test_pattern);
+   if (ctx->options.audio_source != ctx->audio_source || ctx->options.audio_rate != ctx->audio_stress_rate) {
+      ctx->audio_source = ctx->options.audio_source;
+      ctx->audio_stress_rate = ctx->options.audio_rate;
+      audio_init(ctx);
+   }
+   ctx->audio_batch_size = ctx->options.audio_batch;
 
-   enum retro_pixel_format fmt = RETRO_PIXEL_FORMAT_XRGB8888;
-   if (!environ_cb(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &fmt))
+   /* The preferred format first, then the other one */
+   enum retro_pixel_format fmt = ctx->options.pixel_format;
+   if (!ctx->environ_cb(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &fmt))
    {
-      log_cb(RETRO_LOG_INFO, "XRGB8888 is not supported.\n");
-      return false;
+      fmt = fmt == RETRO_PIXEL_FORMAT_RGB565 ? RETRO_PIXEL_FORMAT_XRGB8888 : RETRO_PIXEL_FORMAT_RGB565;
+      ctx->log_cb(RETRO_LOG_INFO, "%s is not supported, trying %s.\n",
+             fmt == RETRO_PIXEL_FORMAT_RGB565 ? "XRGB8888" : "RGB565",
+             fmt == RETRO_PIXEL_FORMAT_RGB565 ? "RGB565" : "XRGB8888");
+      if (!ctx->environ_cb(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &fmt))
+      {
+         ctx->log_cb(RETRO_LOG_INFO, "No supported pixel format.\n");
+         return false;
+      }
    }
+   set_pixel_format(ctx, fmt);
 
-   snprintf(retro_game_path, sizeof(retro_game_path), "%s", info->path);
+   snprintf(ctx->game_path, sizeof(ctx->game_path), "%s", info->path);
 
-   struct retro_audio_callback audio_cb = { NULL, NULL };
-   environ_cb(RETRO_ENVIRONMENT_SET_AUDIO_CALLBACK, &audio_cb);
+   struct retro_audio_callback audio_callback = { NULL, NULL };
+   ctx->environ_cb(RETRO_ENVIRONMENT_SET_AUDIO_CALLBACK, &audio_callback);
+
+   ctx->stats_descriptor.flags = RETRO_MEMDESC_SYSTEM_RAM;
+   ctx->stats_descriptor.ptr = &ctx->stats;
+   ctx->stats_descriptor.len = sizeof(ctx->stats);
+   ctx->stats_descriptor.addrspace = "STATS";
+   struct retro_memory_map memory_map = { &ctx->stats_descriptor, 1 };
+   ctx->environ_cb(RETRO_ENVIRONMENT_SET_MEMORY_MAPS, &memory_map);
 
    (void)info;
    return true;
 }
 
-void retro_unload_game(void)
+void avtest_unload_game(struct avtest *ctx)
 {
+   if (ctx->test_pattern == PATTERN_NOISE)
+      noise_end(ctx);
+   ctx->test_pattern = PATTERN_GRID;
+   ctx->frame_time_cb = NULL;
 }
 
 unsigned retro_get_region(void)
@@ -621,16 +2010,14 @@ bool retro_unserialize(const void *data, size_t size)
    return false;
 }
 
-void *retro_get_memory_data(unsigned id)
+void *avtest_get_memory_data(struct avtest *ctx, unsigned id)
 {
-   (void)id;
-   return NULL;
+   return id == RETRO_MEMORY_SYSTEM_RAM ? &ctx->stats : NULL;
 }
 
-size_t retro_get_memory_size(unsigned id)
+size_t avtest_get_memory_size(struct avtest *ctx, unsigned id)
 {
-   (void)id;
-   return 0;
+   return id == RETRO_MEMORY_SYSTEM_RAM ? sizeof(ctx->stats) : 0;
 }
 
 void retro_cheat_reset(void)
@@ -643,3 +2030,103 @@ void retro_cheat_set(unsigned idx, bool enabled, const char *code)
    (void)enabled;
    (void)code;
 }
+
+struct avtest *avtest_create(void)
+{
+   return calloc(1, sizeof(struct avtest));
+}
+
+void avtest_destroy(struct avtest *ctx)
+{
+   free(ctx);
+}
+
+/* The libretro entry points run the static instance */
+
+static void frame_time_cb(retro_usec_t usec)
+{
+   avtest_frame_time(&core, usec);
+}
+
+static void audio_buffer_status_cb(bool active, unsigned occupancy, bool underrun_likely)
+{
+   avtest_audio_buffer_status(&core, active, occupancy, underrun_likely);
+}
+
+void retro_init(void)
+{
+   avtest_init(&core);
+}
+
+void retro_deinit(void)
+{
+   avtest_deinit(&core);
+}
+
+void retro_get_system_av_info(struct retro_system_av_info *info)
+{
+   avtest_get_system_av_info(&core, info);
+}
+
+void retro_set_environment(retro_environment_t cb)
+{
+   avtest_set_environment(&core, cb);
+}
+
+void retro_set_audio_sample(retro_audio_sample_t cb)
+{
+   avtest_set_audio_sample(&core, cb);
+}
+
+void retro_set_audio_sample_batch(retro_audio_sample_batch_t cb)
+{
+   avtest_set_audio_sample_batch(&core, cb);
+}
+
+void retro_set_input_poll(retro_input_poll_t cb)
+{
+   avtest_set_input_poll(&core, cb);
+}
+
+void retro_set_input_state(retro_input_state_t cb)
+{
+   avtest_set_input_state(&core, cb);
+}
+
+void retro_set_video_refresh(retro_video_refresh_t cb)
+{
+   avtest_set_video_refresh(&core, cb);
+}
+
+void retro_run(void)
+{
+   avtest_run(&core);
+}
+
+bool retro_load_game(const struct retro_game_info *info)
+{
+   if (!avtest_load_game(&core, info))
+      return false;
+
+   core.frame_time_cb = frame_time_cb;
+   register_frame_time(&core);
+
+   struct retro_audio_buffer_status_callback buffer_status = { audio_buffer_status_cb };
+   core.environ_cb(RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK, &buffer_status);
+   return true;
+}
+
+void retro_unload_game(void)
+{
+   avtest_unload_game(&core);
+}
+
+void *retro_get_memory_data(unsigned id)
+{
+   return avtest_get_memory_data(&core, id);
+}
+
+size_t retro_get_memory_size(unsigned id)
+{
+   return avtest_get_memory_size(&core, id);
+}
@@ -0,0 +1,715 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+#if (defined(__aarch64__) || defined(__ARM_NEON)) && !defined(__ARM_BIG_ENDIAN)
+#define KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* The four-register table lookups only exist on AArch64 */
+#if defined(KERNELS_NEON) && defined(__aarch64__)
+#define KERNELS_NEON_A64 1
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define KERNELS_LITTLE_ENDIAN 1
+#endif
+
+static inline int16_t load_le_s16(const uint8_t *data)
+{
+   return (int16_t)((uint16_t)data[0] | (uint16_t)(data[1] << 8));
+}
+
+/* Plain C versions, also used for the tails of the vector loops. */
+
+static void interleave_s16_c(int16_t *dst, const uint8_t *left, const uint8_t *right, size_t frames)
+{
+   for (size_t i = 0; i < frames; i++) {
+      dst[i * 2 + 0] = left ? load_le_s16(left + i * 2) : 0;
+      dst[i * 2 + 1] = right ? load_le_s16(right + i * 2) : 0;
+   }
+}
+
+static void copy_stereo_s16_c(int16_t *dst, const uint8_t *src, size_t frames)
+{
+#ifdef KERNELS_LITTLE_ENDIAN
+   memcpy(dst, src, frames * 2 * sizeof(int16_t));
+#else
+   for (size_t i = 0; i < frames * 2; i++)
+      dst[i] = load_le_s16(src + i * 2);
+#endif
+}
+
+static void upsample_s16_c(int16_t *dst, const int16_t *src, size_t frames, unsigned factor)
+{
+   for (size_t i = 0; i < frames; i++) {
+      for (unsigned k = 0; k < factor; k++) {
+         dst[(i * factor + k) * 2 + 0] = src[i * 2 + 0];
+         dst[(i * factor + k) * 2 + 1] = src[i * 2 + 1];
+      }
+   }
+}
+
+static inline int16_t saturate_s16(int32_t x)
+{
+   return (int16_t)(x > INT16_MAX ? INT16_MAX : x < INT16_MIN ? INT16_MIN : x);
+}
+
+static void mix_s16_c(int16_t *dst, const uint8_t *src, size_t frames, int16_t gain_l, int16_t gain_r)
+{
+   for (size_t i = 0; i < frames; i++) {
+      int32_t s = load_le_s16(src + i * 2);
+      dst[i * 2 + 0] = saturate_s16(dst[i * 2 + 0] + ((s * gain_l + 0x4000) >> 15));
+      dst[i * 2 + 1] = saturate_s16(dst[i * 2 + 1] + ((s * gain_r + 0x4000) >> 15));
+   }
+}
+
+static void expand_idx8_c(uint8_t *dst, const uint8_t *src, size_t pixels, const struct pixel_lut *lut)
+{
+   if (lut->bpp == 2) {
+      uint16_t *out = (uint16_t *)dst;
+      for (size_t i = 0; i < pixels; i++)
+         out[i] = (uint16_t)lut->pixels[src[i]];
+   } else {
+      uint32_t *out = (uint32_t *)dst;
+      for (size_t i = 0; i < pixels; i++)
+         out[i] = lut->pixels[src[i]];
+   }
+}
+
+static void stream_copy_c(void *dst, const void *src, size_t bytes)
+{
+   memcpy(dst, src, bytes);
+}
+
+static inline uint32_t xorshift32(uint32_t x)
+{
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   return x;
+}
+
+static void noise_fill_c(uint8_t *dst, size_t bytes, uint32_t *state)
+{
+   unsigned lane = 0;
+
+   for (size_t i = 0; i < bytes; i += 4) {
+      const uint32_t x = state[lane] = xorshift32(state[lane]);
+
+      for (unsigned b = 0; b < 4 && i + b < bytes; b++)
+         dst[i + b] = (uint8_t)(x >> (8 * b));
+      lane = (lane + 1) % NOISE_LANES;
+   }
+}
+
+void pixel_lut_init(struct pixel_lut *lut, const uint32_t *pixels, unsigned size, unsigned bpp)
+{
+   if (size > 256)
+      size = 256;
+
+   memset(lut, 0, sizeof(*lut));
+   lut->bpp = bpp;
+   lut->size = size;
+
+   for (unsigned i = 0; i < size; i++) {
+      uint32_t pixel = bpp == 2 ? pixels[i] & 0xFFFF : pixels[i];
+
+      lut->pixels[i] = pixel;
+      for (unsigned b = 0; b < 4; b++)
+         lut->planes[b][i] = (uint8_t)(pixel >> (8 * b));
+   }
+}
+
+#ifdef KERNELS_X86
+__attribute__((target("sse4.1")))
+static void interleave_s16_sse41(int16_t *dst, const uint8_t *left, const uint8_t *right, size_t frames)
+{
+   const __m128i zero = _mm_setzero_si128();
+   size_t i = 0;
+
+   for (; i + 8 <= frames; i += 8) {
+      __m128i l = left ? _mm_loadu_si128((const __m128i *)(left + i * 2)) : zero;
+      __m128i r = right ? _mm_loadu_si128((const __m128i *)(right + i * 2)) : zero;
+      _mm_storeu_si128((__m128i *)(dst + i * 2), _mm_unpacklo_epi16(l, r));
+      _mm_storeu_si128((__m128i *)(dst + i * 2 + 8), _mm_unpackhi_epi16(l, r));
+   }
+
+   interleave_s16_c(dst + i * 2, left ? left + i * 2 : NULL,
+                    right ? right + i * 2 : NULL, frames - i);
+}
+
+__attribute__((target("avx2")))
+static void interleave_s16_avx2(int16_t *dst, const uint8_t *left, const uint8_t *right, size_t frames)
+{
+   const __m256i zero = _mm256_setzero_si256();
+   size_t i = 0;
+
+   for (; i + 16 <= frames; i += 16) {
+      __m256i l = left ? _mm256_loadu_si256((const __m256i *)(left + i * 2)) : zero;
+      __m256i r = right ? _mm256_loadu_si256((const __m256i *)(right + i * 2)) : zero;
+      /* unpack works per 128-bit lane, so restore frame order afterwards */
+      __m256i lo = _mm256_unpacklo_epi16(l, r);
+      __m256i hi = _mm256_unpackhi_epi16(l, r);
+      _mm256_storeu_si256((__m256i *)(dst + i * 2), _mm256_permute2x128_si256(lo, hi, 0x20));
+      _mm256_storeu_si256((__m256i *)(dst + i * 2 + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+   }
+
+   interleave_s16_c(dst + i * 2, left ? left + i * 2 : NULL,
+                    right ? right + i * 2 : NULL, frames - i);
+}
+
+/* PMULHRSW scales with the same rounding as the C loop, as the gains
+ * never reach 32768 */
+__attribute__((target("sse4.1")))
+static void mix_s16_sse41(int16_t *dst, const uint8_t *src, size_t frames, int16_t gain_l, int16_t gain_r)
+{
+   const __m128i gains = _mm_set1_epi32((int)((uint32_t)(uint16_t)gain_l | (uint32_t)(uint16_t)gain_r << 16));
+   size_t i = 0;
+
+   for (; i + 8 <= frames; i += 8) {
+      __m128i s = _mm_loadu_si128((const __m128i *)(src + i * 2));
+      __m128i lo = _mm_mulhrs_epi16(_mm_unpacklo_epi16(s, s), gains);
+      __m128i hi = _mm_mulhrs_epi16(_mm_unpackhi_epi16(s, s), gains);
+      __m128i *d = (__m128i *)(dst + i * 2);
+      _mm_storeu_si128(d, _mm_adds_epi16(_mm_loadu_si128(d), lo));
+      _mm_storeu_si128(d + 1, _mm_adds_epi16(_mm_loadu_si128(d + 1), hi));
+   }
+
+   mix_s16_c(dst + i * 2, src + i * 2, frames - i, gain_l, gain_r);
+}
+
+__attribute__((target("avx2")))
+static void mix_s16_avx2(int16_t *dst, const uint8_t *src, size_t frames, int16_t gain_l, int16_t gain_r)
+{
+   const __m256i gains = _mm256_set1_epi32((int)((uint32_t)(uint16_t)gain_l | (uint32_t)(uint16_t)gain_r << 16));
+   size_t i = 0;
+
+   for (; i + 16 <= frames; i += 16) {
+      __m256i s = _mm256_loadu_si256((const __m256i *)(src + i * 2));
+      __m256i lo = _mm256_unpacklo_epi16(s, s);
+      __m256i hi = _mm256_unpackhi_epi16(s, s);
+      __m256i a = _mm256_mulhrs_epi16(_mm256_permute2x128_si256(lo, hi, 0x20), gains);
+      __m256i b = _mm256_mulhrs_epi16(_mm256_permute2x128_si256(lo, hi, 0x31), gains);
+      __m256i *d = (__m256i *)(dst + i * 2);
+      _mm256_storeu_si256(d, _mm256_adds_epi16(_mm256_loadu_si256(d), a));
+      _mm256_storeu_si256(d + 1, _mm256_adds_epi16(_mm256_loadu_si256(d + 1), b));
+   }
+
+   mix_s16_c(dst + i * 2, src + i * 2, frames - i, gain_l, gain_r);
+}
+
+/* PSHUFB looks up one byte plane of a 16-entry palette at a time; the
+ * planes are then interleaved into pixels. Bigger palettes use the C
+ * loop, as emulating a 256-entry lookup with shuffles costs more than it
+ * saves. */
+__attribute__((target("sse4.1")))
+static void expand_idx8_sse41(uint8_t *dst, const uint8_t *src, size_t pixels, const struct pixel_lut *lut)
+{
+   size_t i = 0;
+
+   if (lut->size <= 16) {
+      const __m128i t0 = _mm_loadu_si128((const __m128i *)lut->planes[0]);
+      const __m128i t1 = _mm_loadu_si128((const __m128i *)lut->planes[1]);
+      const __m128i t2 = _mm_loadu_si128((const __m128i *)lut->planes[2]);
+      const __m128i t3 = _mm_loadu_si128((const __m128i *)lut->planes[3]);
+
+      for (; i + 16 <= pixels; i += 16) {
+         __m128i idx = _mm_loadu_si128((const __m128i *)(src + i));
+         __m128i b0 = _mm_shuffle_epi8(t0, idx);
+         __m128i b1 = _mm_shuffle_epi8(t1, idx);
+
+         if (lut->bpp == 2) {
+            _mm_storeu_si128((__m128i *)(dst + i * 2), _mm_unpacklo_epi8(b0, b1));
+            _mm_storeu_si128((__m128i *)(dst + i * 2 + 16), _mm_unpackhi_epi8(b0, b1));
+         } else {
+            __m128i b2 = _mm_shuffle_epi8(t2, idx);
+            __m128i b3 = _mm_shuffle_epi8(t3, idx);
+            __m128i lo01 = _mm_unpacklo_epi8(b0, b1);
+            __m128i hi01 = _mm_unpackhi_epi8(b0, b1);
+            __m128i lo23 = _mm_unpacklo_epi8(b2, b3);
+            __m128i hi23 = _mm_unpackhi_epi8(b2, b3);
+            _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_unpacklo_epi16(lo01, lo23));
+            _mm_storeu_si128((__m128i *)(dst + i * 4 + 16), _mm_unpackhi_epi16(lo01, lo23));
+            _mm_storeu_si128((__m128i *)(dst + i * 4 + 32), _mm_unpacklo_epi16(hi01, hi23));
+            _mm_storeu_si128((__m128i *)(dst + i * 4 + 48), _mm_unpackhi_epi16(hi01, hi23));
+         }
+      }
+   }
+
+   expand_idx8_c(dst + i * lut->bpp, src + i, pixels - i, lut);
+}
+
+/* A stereo frame is one 32-bit lane, so repeating frames is a lane
+ * shuffle. Factors other than 2 and 4 take the C loop. */
+__attribute__((target("sse4.1")))
+static void upsample_s16_sse41(int16_t *dst, const int16_t *src, size_t frames, unsigned factor)
+{
+   size_t i = 0;
+
+   if (factor == 2) {
+      for (; i + 4 <= frames; i += 4) {
+         __m128i x = _mm_loadu_si128((const __m128i *)(src + i * 2));
+         _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_unpacklo_epi32(x, x));
+         _mm_storeu_si128((__m128i *)(dst + i * 4 + 8), _mm_unpackhi_epi32(x, x));
+      }
+   } else if (factor == 4) {
+      for (; i + 4 <= frames; i += 4) {
+         __m128i x = _mm_loadu_si128((const __m128i *)(src + i * 2));
+         _mm_storeu_si128((__m128i *)(dst + i * 8), _mm_shuffle_epi32(x, 0x00));
+         _mm_storeu_si128((__m128i *)(dst + i * 8 + 8), _mm_shuffle_epi32(x, 0x55));
+         _mm_storeu_si128((__m128i *)(dst + i * 8 + 16), _mm_shuffle_epi32(x, 0xAA));
+         _mm_storeu_si128((__m128i *)(dst + i * 8 + 24), _mm_shuffle_epi32(x, 0xFF));
+      }
+   }
+
+   upsample_s16_c(dst + i * factor * 2, src + i * 2, frames - i, factor);
+}
+
+__attribute__((target("avx2")))
+static void upsample_s16_avx2(int16_t *dst, const int16_t *src, size_t frames, unsigned factor)
+{
+   size_t i = 0;
+
+   if (factor == 2) {
+      for (; i + 8 <= frames; i += 8) {
+         __m256i x = _mm256_loadu_si256((const __m256i *)(src + i * 2));
+         /* per 128-bit lane: lo holds frames 0, 1, 4, 5 and hi 2, 3, 6, 7 */
+         __m256i lo = _mm256_unpacklo_epi32(x, x);
+         __m256i hi = _mm256_unpackhi_epi32(x, x);
+         _mm256_storeu_si256((__m256i *)(dst + i * 4), _mm256_permute2x128_si256(lo, hi, 0x20));
+         _mm256_storeu_si256((__m256i *)(dst + i * 4 + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+      }
+   } else if (factor == 4) {
+      const __m256i idx0 = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+      const __m256i step = _mm256_set1_epi32(2);
+
+      for (; i + 8 <= frames; i += 8) {
+         __m256i x = _mm256_loadu_si256((const __m256i *)(src + i * 2));
+         __m256i idx = idx0;
+         for (unsigned k = 0; k < 4; k++, idx = _mm256_add_epi32(idx, step))
+            _mm256_storeu_si256((__m256i *)(dst + i * 8 + k * 16), _mm256_permutevar8x32_epi32(x, idx));
+      }
+   }
+
+   upsample_s16_c(dst + i * factor * 2, src + i * 2, frames - i, factor);
+}
+
+/* Small palettes use VPSHUFB like the SSE4.1 version; bigger ones gather
+ * whole pixels from lut->pixels. */
+__attribute__((target("avx2")))
+static void expand_idx8_avx2(uint8_t *dst, const uint8_t *src, size_t pixels, const struct pixel_lut *lut)
+{
+   const int *table = (const int *)lut->pixels;
+   size_t i = 0;
+
+   if (lut->size <= 16) {
+      const __m256i t0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lut->planes[0]));
+      const __m256i t1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lut->planes[1]));
+      const __m256i t2 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lut->planes[2]));
+      const __m256i t3 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lut->planes[3]));
+
+      for (; i + 32 <= pixels; i += 32) {
+         __m256i idx = _mm256_loadu_si256((const __m256i *)(src + i));
+         __m256i b0 = _mm256_shuffle_epi8(t0, idx);
+         __m256i b1 = _mm256_shuffle_epi8(t1, idx);
+         /* unpack works per 128-bit lane: lo01 holds pixels 0-7 and
+          * 16-23, hi01 pixels 8-15 and 24-31 */
+         __m256i lo01 = _mm256_unpacklo_epi8(b0, b1);
+         __m256i hi01 = _mm256_unpackhi_epi8(b0, b1);
+
+         if (lut->bpp == 2) {
+            _mm256_storeu_si256((__m256i *)(dst + i * 2), _mm256_permute2x128_si256(lo01, hi01, 0x20));
+            _mm256_storeu_si256((__m256i *)(dst + i * 2 + 32), _mm256_permute2x128_si256(lo01, hi01, 0x31));
+         } else {
+            __m256i b2 = _mm256_shuffle_epi8(t2, idx);
+            __m256i b3 = _mm256_shuffle_epi8(t3, idx);
+            __m256i lo23 = _mm256_unpacklo_epi8(b2, b3);
+            __m256i hi23 = _mm256_unpackhi_epi8(b2, b3);
+            __m256i p0 = _mm256_unpacklo_epi16(lo01, lo23); /* 0-3, 16-19 */
+            __m256i p1 = _mm256_unpackhi_epi16(lo01, lo23); /* 4-7, 20-23 */
+            __m256i p2 = _mm256_unpacklo_epi16(hi01, hi23); /* 8-11, 24-27 */
+            __m256i p3 = _mm256_unpackhi_epi16(hi01, hi23); /* 12-15, 28-31 */
+            _mm256_storeu_si256((__m256i *)(dst + i * 4), _mm256_permute2x128_si256(p0, p1, 0x20));
+            _mm256_storeu_si256((__m256i *)(dst + i * 4 + 32), _mm256_permute2x128_si256(p2, p3, 0x20));
+            _mm256_storeu_si256((__m256i *)(dst + i * 4 + 64), _mm256_permute2x128_si256(p0, p1, 0x31));
+            _mm256_storeu_si256((__m256i *)(dst + i * 4 + 96), _mm256_permute2x128_si256(p2, p3, 0x31));
+         }
+      }
+   } else if (lut->bpp == 2) {
+      for (; i + 16 <= pixels; i += 16) {
+         __m256i lo = _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i))), 4);
+         __m256i hi = _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i + 8))), 4);
+         /* packus works per 128-bit lane, so restore pixel order afterwards */
+         _mm256_storeu_si256((__m256i *)(dst + i * 2), _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8));
+      }
+   } else {
+      for (; i + 8 <= pixels; i += 8) {
+         __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+         _mm256_storeu_si256((__m256i *)(dst + i * 4), _mm256_i32gather_epi32(table, idx, 4));
+      }
+   }
+
+   expand_idx8_c(dst + i * lut->bpp, src + i, pixels - i, lut);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i xorshift32_sse41(__m128i x)
+{
+   x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+   x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+   return _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+}
+
+/* Eight independent vectors of four lanes each */
+__attribute__((target("sse4.1")))
+static void noise_fill_sse41(uint8_t *dst, size_t bytes, uint32_t *state)
+{
+   __m128i x[NOISE_LANES / 4];
+   size_t i = 0;
+
+   for (unsigned v = 0; v < NOISE_LANES / 4; v++)
+      x[v] = _mm_loadu_si128((const __m128i *)(state + v * 4));
+
+   for (; i + NOISE_LANES * 4 <= bytes; i += NOISE_LANES * 4) {
+      for (unsigned v = 0; v < NOISE_LANES / 4; v++) {
+         x[v] = xorshift32_sse41(x[v]);
+         _mm_storeu_si128((__m128i *)(dst + i + v * 16), x[v]);
+      }
+   }
+
+   for (unsigned v = 0; v < NOISE_LANES / 4; v++)
+      _mm_storeu_si128((__m128i *)(state + v * 4), x[v]);
+   noise_fill_c(dst + i, bytes - i, state);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i xorshift32_avx2(__m256i x)
+{
+   x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+   x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+   return _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+}
+
+__attribute__((target("avx2")))
+static void noise_fill_avx2(uint8_t *dst, size_t bytes, uint32_t *state)
+{
+   __m256i x[NOISE_LANES / 8];
+   size_t i = 0;
+
+   for (unsigned v = 0; v < NOISE_LANES / 8; v++)
+      x[v] = _mm256_loadu_si256((const __m256i *)(state + v * 8));
+
+   for (; i + NOISE_LANES * 4 <= bytes; i += NOISE_LANES * 4) {
+      for (unsigned v = 0; v < NOISE_LANES / 8; v++) {
+         x[v] = xorshift32_avx2(x[v]);
+         _mm256_storeu_si256((__m256i *)(dst + i + v * 32), x[v]);
+      }
+   }
+
+   for (unsigned v = 0; v < NOISE_LANES / 8; v++)
+      _mm256_storeu_si256((__m256i *)(state + v * 8), x[v]);
+   noise_fill_c(dst + i, bytes - i, state);
+}
+
+/* Unaligned head and tail go through memcpy; the fence orders the
+ * streamed stores before anything the caller writes next. */
+__attribute__((target("sse4.1")))
+static void stream_copy_sse41(void *dst, const void *src, size_t bytes)
+{
+   uint8_t *d = dst;
+   const uint8_t *s = src;
+   size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+
+   if (bytes < head + 64) {
+      memcpy(d, s, bytes);
+      return;
+   }
+
+   memcpy(d, s, head);
+   d += head;
+   s += head;
+   bytes -= head;
+
+   for (; bytes >= 64; bytes -= 64, d += 64, s += 64) {
+      __m128i a = _mm_loadu_si128((const __m128i *)s);
+      __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+      __m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+      __m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+      _mm_stream_si128((__m128i *)d, a);
+      _mm_stream_si128((__m128i *)(d + 16), b);
+      _mm_stream_si128((__m128i *)(d + 32), c);
+      _mm_stream_si128((__m128i *)(d + 48), e);
+   }
+   _mm_sfence();
+   memcpy(d, s, bytes);
+}
+
+__attribute__((target("avx2")))
+static void stream_copy_avx2(void *dst, const void *src, size_t bytes)
+{
+   uint8_t *d = dst;
+   const uint8_t *s = src;
+   size_t head = (32 - ((uintptr_t)d & 31)) & 31;
+
+   if (bytes < head + 128) {
+      memcpy(d, s, bytes);
+      return;
+   }
+
+   memcpy(d, s, head);
+   d += head;
+   s += head;
+   bytes -= head;
+
+   for (; bytes >= 128; bytes -= 128, d += 128, s += 128) {
+      __m256i a = _mm256_loadu_si256((const __m256i *)s);
+      __m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+      __m256i c = _mm256_loadu_si256((const __m256i *)(s + 64));
+      __m256i e = _mm256_loadu_si256((const __m256i *)(s + 96));
+      _mm256_stream_si256((__m256i *)d, a);
+      _mm256_stream_si256((__m256i *)(d + 32), b);
+      _mm256_stream_si256((__m256i *)(d + 64), c);
+      _mm256_stream_si256((__m256i *)(d + 96), e);
+   }
+   _mm_sfence();
+   memcpy(d, s, bytes);
+}
+#endif
+
+#ifdef KERNELS_NEON
+static void interleave_s16_neon(int16_t *dst, const uint8_t *left, const uint8_t *right, size_t frames)
+{
+   const int16x8_t zero = vdupq_n_s16(0);
+   size_t i = 0;
+
+   for (; i + 8 <= frames; i += 8) {
+      int16x8x2_t lr;
+      lr.val[0] = left ? vreinterpretq_s16_u8(vld1q_u8(left + i * 2)) : zero;
+      lr.val[1] = right ? vreinterpretq_s16_u8(vld1q_u8(right + i * 2)) : zero;
+      vst2q_s16(dst + i * 2, lr);
+   }
+
+   interleave_s16_c(dst + i * 2, left ? left + i * 2 : NULL,
+                    right ? right + i * 2 : NULL, frames - i);
+}
+
+/* VQRDMULH doubles before rounding off 16 bits, which is the same as the
+ * C loop's rounding off 15 */
+static void mix_s16_neon(int16_t *dst, const uint8_t *src, size_t frames, int16_t gain_l, int16_t gain_r)
+{
+   size_t i = 0;
+
+   for (; i + 8 <= frames; i += 8) {
+      int16x8_t s = vreinterpretq_s16_u8(vld1q_u8(src + i * 2));
+      int16x8x2_t d = vld2q_s16(dst + i * 2);
+      d.val[0] = vqaddq_s16(d.val[0], vqrdmulhq_n_s16(s, gain_l));
+      d.val[1] = vqaddq_s16(d.val[1], vqrdmulhq_n_s16(s, gain_r));
+      vst2q_s16(dst + i * 2, d);
+   }
+
+   mix_s16_c(dst + i * 2, src + i * 2, frames - i, gain_l, gain_r);
+}
+
+static void upsample_s16_neon(int16_t *dst, const int16_t *src, size_t frames, unsigned factor)
+{
+   size_t i = 0;
+
+   if (factor == 2) {
+      for (; i + 4 <= frames; i += 4) {
+         uint32x4_t x = vreinterpretq_u32_s16(vld1q_s16(src + i * 2));
+         uint32x4x2_t z = vzipq_u32(x, x);
+         vst1q_s16(dst + i * 4, vreinterpretq_s16_u32(z.val[0]));
+         vst1q_s16(dst + i * 4 + 8, vreinterpretq_s16_u32(z.val[1]));
+      }
+   } else if (factor == 4) {
+      for (; i + 4 <= frames; i += 4) {
+         uint32x4_t x = vreinterpretq_u32_s16(vld1q_s16(src + i * 2));
+         vst1q_s16(dst + i * 8, vreinterpretq_s16_u32(vdupq_n_u32(vgetq_lane_u32(x, 0))));
+         vst1q_s16(dst + i * 8 + 8, vreinterpretq_s16_u32(vdupq_n_u32(vgetq_lane_u32(x, 1))));
+         vst1q_s16(dst + i * 8 + 16, vreinterpretq_s16_u32(vdupq_n_u32(vgetq_lane_u32(x, 2))));
+         vst1q_s16(dst + i * 8 + 24, vreinterpretq_s16_u32(vdupq_n_u32(vgetq_lane_u32(x, 3))));
+      }
+   }
+
+   upsample_s16_c(dst + i * factor * 2, src + i * 2, frames - i, factor);
+}
+
+static void noise_fill_neon(uint8_t *dst, size_t bytes, uint32_t *state)
+{
+   uint32x4_t x[NOISE_LANES / 4];
+   size_t i = 0;
+
+   for (unsigned v = 0; v < NOISE_LANES / 4; v++)
+      x[v] = vld1q_u32(state + v * 4);
+
+   for (; i + NOISE_LANES * 4 <= bytes; i += NOISE_LANES * 4) {
+      for (unsigned v = 0; v < NOISE_LANES / 4; v++) {
+         x[v] = veorq_u32(x[v], vshlq_n_u32(x[v], 13));
+         x[v] = veorq_u32(x[v], vshrq_n_u32(x[v], 17));
+         x[v] = veorq_u32(x[v], vshlq_n_u32(x[v], 5));
+         vst1q_u8(dst + i + v * 16, vreinterpretq_u8_u32(x[v]));
+      }
+   }
+
+   for (unsigned v = 0; v < NOISE_LANES / 4; v++)
+      vst1q_u32(state + v * 4, x[v]);
+   noise_fill_c(dst + i, bytes - i, state);
+}
+#endif
+
+#ifdef KERNELS_NEON_A64
+static uint8x16x4_t load_table64(const uint8_t *table)
+{
+   uint8x16x4_t t;
+   t.val[0] = vld1q_u8(table);
+   t.val[1] = vld1q_u8(table + 16);
+   t.val[2] = vld1q_u8(table + 32);
+   t.val[3] = vld1q_u8(table + 48);
+   return t;
+}
+
+/* TBL looks up one byte plane in 64 entries at a time; bigger palettes
+ * chain TBX over the following 64-entry blocks, which leaves the lanes
+ * whose index falls outside the block untouched. */
+static void expand_idx8_neon(uint8_t *dst, const uint8_t *src, size_t pixels, const struct pixel_lut *lut)
+{
+   const unsigned blocks = (lut->size + 63) / 64;
+   size_t i = 0;
+
+   for (; i + 16 <= pixels; i += 16) {
+      const uint8x16_t idx = vld1q_u8(src + i);
+      uint8x16_t bytes[4];
+
+      for (unsigned b = 0; b < lut->bpp; b++) {
+         bytes[b] = vqtbl4q_u8(load_table64(lut->planes[b]), idx);
+         for (unsigned k = 1; k < blocks; k++)
+            bytes[b] = vqtbx4q_u8(bytes[b], load_table64(lut->planes[b] + 64 * k),
+                                  vsubq_u8(idx, vdupq_n_u8((uint8_t)(64 * k))));
+      }
+
+      if (lut->bpp == 2) {
+         uint8x16x2_t px = { { bytes[0], bytes[1] } };
+         vst2q_u8(dst + i * 2, px);
+      } else {
+         uint8x16x4_t px = { { bytes[0], bytes[1], bytes[2], bytes[3] } };
+         vst4q_u8(dst + i * 4, px);
+      }
+   }
+
+   expand_idx8_c(dst + i * lut->bpp, src + i, pixels - i, lut);
+}
+#endif
+
+struct kernels kernels = {
+   "C",
+   interleave_s16_c,
+   copy_stereo_s16_c,
+   upsample_s16_c,
+   mix_s16_c,
+   expand_idx8_c,
+   stream_copy_c,
+   noise_fill_c,
+};
+
+/* AVTEST_KERNELS=C (or SSE4.1) caps the selection, which lets the
+ * benchmarks and regression scripts compare implementations. */
+static void kernels_select(void)
+{
+   const char *cap = getenv("AVTEST_KERNELS");
+   struct kernels k;
+
+   k.name = "C";
+   k.interleave_s16 = interleave_s16_c;
+   k.copy_stereo_s16 = copy_stereo_s16_c;
+   k.upsample_s16 = upsample_s16_c;
+   k.mix_s16 = mix_s16_c;
+   k.expand_idx8 = expand_idx8_c;
+   k.stream_copy = stream_copy_c;
+   k.noise_fill = noise_fill_c;
+
+   if (cap && strcasecmp(cap, "C") == 0) {
+      kernels = k;
+      return;
+   }
+
+#if defined(KERNELS_NEON)
+   k.name = "NEON";
+   k.interleave_s16 = interleave_s16_neon;
+   k.upsample_s16 = upsample_s16_neon;
+   k.mix_s16 = mix_s16_neon;
+   k.noise_fill = noise_fill_neon;
+#ifdef KERNELS_NEON_A64
+   k.expand_idx8 = expand_idx8_neon;
+#endif
+#elif defined(KERNELS_X86)
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2") && !(cap && strcasecmp(cap, "SSE4.1") == 0)) {
+      k.name = "AVX2";
+      k.interleave_s16 = interleave_s16_avx2;
+      k.upsample_s16 = upsample_s16_avx2;
+      k.mix_s16 = mix_s16_avx2;
+      k.expand_idx8 = expand_idx8_avx2;
+      k.stream_copy = stream_copy_avx2;
+      k.noise_fill = noise_fill_avx2;
+   } else if (__builtin_cpu_supports("sse4.1")) {
+      k.name = "SSE4.1";
+      k.interleave_s16 = interleave_s16_sse41;
+      k.upsample_s16 = upsample_s16_sse41;
+      k.mix_s16 = mix_s16_sse41;
+      k.expand_idx8 = expand_idx8_sse41;
+      k.stream_copy = stream_copy_sse41;
+      k.noise_fill = noise_fill_sse41;
+   }
+#endif
+
+   kernels = k;
+}
+
+/* The table is picked by the first call only, so core instances that
+ * initialize while others run never write it again */
+void kernels_init(void)
+{
+   static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+   pthread_once(&once, kernels_select);
+}
+
+void frame_copy(void *dst, const void *src, size_t bytes, size_t frame_bytes)
+{
+   if (frame_bytes >= STREAM_MIN_FRAME_BYTES)
+      kernels.stream_copy(dst, src, bytes);
+   else
+      memcpy(dst, src, bytes);
+}
+
+/* Doubles the filled part with cached copies up to REPEAT_CACHED_BYTES,
+ * then copies from that part on: streamed stores are not read back. */
+#define REPEAT_CACHED_BYTES (64 * 1024)
+
+void frame_repeat(void *dst, size_t period, size_t bytes, size_t frame_bytes)
+{
+   uint8_t *d = dst;
+   size_t done = period;
+
+   while (done < bytes && done < REPEAT_CACHED_BYTES) {
+      size_t n = bytes - done < done ? bytes - done : done;
+      memcpy(d + done, d, n);
+      done += n;
+   }
+
+   for (const size_t block = done; done < bytes;) {
+      size_t n = bytes - done < block ? bytes - done : block;
+      frame_copy(d + done, d, n, frame_bytes);
+      done += n;
+   }
+}
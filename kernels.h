@@ -0,0 +1,73 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A palette converted to the output pixel format (bpp is 2 or 4). The
+ * planes hold byte n of every entry, little-endian, for the byte-shuffle
+ * lookups; pixel_lut_init() fills them. Entries past size are zero. */
+struct pixel_lut {
+   unsigned bpp;
+   unsigned size;
+   uint32_t pixels[256];
+   uint8_t planes[4][256];
+};
+
+void pixel_lut_init(struct pixel_lut *lut, const uint32_t *pixels, unsigned size, unsigned bpp);
+
+/* Audio and pixel inner loops. retro_init() picks the best implementation
+ * for the running CPU once (NEON, AVX2, SSE4.1 or plain C), so a single
+ * binary runs on every machine of an architecture. */
+struct kernels {
+   const char *name;
+
+   /* Interleaves two little-endian 16-bit mono streams into stereo frames.
+    * A NULL channel is written as silence. */
+   void (*interleave_s16)(int16_t *dst, const uint8_t *left, const uint8_t *right, size_t frames);
+
+   /* Copies interleaved little-endian 16-bit stereo frames. */
+   void (*copy_stereo_s16)(int16_t *dst, const uint8_t *src, size_t frames);
+
+   /* Writes every stereo frame of src factor times in a row. */
+   void (*upsample_s16)(int16_t *dst, const int16_t *src, size_t frames, unsigned factor);
+
+   /* Adds a little-endian 16-bit mono stream to stereo frames, scaled by
+    * Q15 gains of 0 to 32767 per channel, with saturation. Each product
+    * rounds as (sample * gain + 0x4000) >> 15. */
+   void (*mix_s16)(int16_t *dst, const uint8_t *src, size_t frames, int16_t gain_l, int16_t gain_r);
+
+   /* Expands 8-bit palette indices, all below lut->size, to pixels. */
+   void (*expand_idx8)(uint8_t *dst, const uint8_t *src, size_t pixels, const struct pixel_lut *lut);
+
+   /* memcpy with non-temporal stores, which skip the caches */
+   void (*stream_copy)(void *dst, const void *src, size_t bytes);
+
+   /* Fills dst with xorshift32 noise. Every 128-byte block steps each of
+    * the NOISE_LANES generators once and stores their results in lane
+    * order as little-endian words; a shorter tail steps the first lanes
+    * only. Every implementation writes the same bytes. */
+   void (*noise_fill)(uint8_t *dst, size_t bytes, uint32_t *state);
+};
+
+#define NOISE_LANES 32
+
+extern struct kernels kernels;
+
+/* Picks the table on the first call; later calls, from any thread,
+ * leave it alone */
+void kernels_init(void);
+
+/* Frames from this size up do not stay cached until the frontend reads
+ * them, so caching their stores would only evict everything else. */
+#define STREAM_MIN_FRAME_BYTES (1024 * 1024)
+
+/* Copies into a frame of frame_bytes: stream_copy for the large ones,
+ * memcpy otherwise. */
+void frame_copy(void *dst, const void *src, size_t bytes, size_t frame_bytes);
+
+/* Fills dst up to bytes by repeating its first period bytes, in a frame
+ * of frame_bytes. */
+void frame_repeat(void *dst, size_t period, size_t bytes, size_t frame_bytes);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef MARKERS_H
+#define MARKERS_H
+
+/* Frame markers, enabled with the avtest_markers option, so that a
+ * capture of the frontend's output can be matched to core frames.
+ * tools/avanalyze decodes them.
+ *
+ * Video: a MARKER_CELLS x 1 barcode of MARKER_CELL x MARKER_CELL white
+ * (1) or black (0) cells along the bottom-left edge of every frame: a
+ * white start cell, the 32-bit frame counter MSB first, then an even
+ * parity cell over the counter bits.
+ *
+ * Audio: the first MARKER_AUDIO_FRAMES stereo frames of every audio
+ * batch. MARKER_AUDIO_SYNC frames of +L, -L, +L, -L are followed by the
+ * low MARKER_AUDIO_BITS bits of the frame counter, MSB first, each as
+ * +L (1) or -L (0), where L is MARKER_LEVEL. The right channel always
+ * holds the negated left sample. The counter is that of the video frame
+ * the batch is sent with. */
+#define MARKER_CELL 8
+#define MARKER_BITS 32
+#define MARKER_CELLS (MARKER_BITS + 2)
+
+#define MARKER_LEVEL 291 /* about -41 dBFS */
+#define MARKER_AUDIO_SYNC 4
+#define MARKER_AUDIO_BITS 16
+#define MARKER_AUDIO_FRAMES (MARKER_AUDIO_SYNC + MARKER_AUDIO_BITS)
+
+#endif
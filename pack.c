@@ -0,0 +1,100 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pack.h"
+
+static uint32_t pack_le_u32(const uint8_t *data)
+{
+   return (uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+          ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static bool pack_valid(const uint8_t *data, size_t size)
+{
+   if (size < PACK_HEADER_SIZE || memcmp(data, PACK_MAGIC, 8) != 0)
+      return false;
+
+   uint32_t count = pack_le_u32(data + 8);
+   if (count > (size - PACK_HEADER_SIZE) / PACK_ENTRY_SIZE)
+      return false;
+
+   for (uint32_t i = 0; i < count; i++) {
+      const uint8_t *entry = data + PACK_HEADER_SIZE + i * PACK_ENTRY_SIZE;
+      uint32_t offset = pack_le_u32(entry + PACK_NAME_SIZE);
+      uint32_t length = pack_le_u32(entry + PACK_NAME_SIZE + 4);
+
+      if (memchr(entry, '\0', PACK_NAME_SIZE) == NULL)
+         return false;
+      if (offset > size || length > size - offset)
+         return false;
+   }
+
+   return true;
+}
+
+bool pack_open(struct pack *pack, const char *path)
+{
+   struct stat st;
+   void *map;
+   int fd;
+
+   pack_close(pack);
+
+   fd = open(path, O_RDONLY | O_CLOEXEC);
+   if (fd < 0)
+      return false;
+
+   if (fstat(fd, &st) != 0) {
+      close(fd);
+      return false;
+   }
+
+   if (st.st_size < PACK_HEADER_SIZE || (uint64_t)st.st_size > SIZE_MAX) {
+      close(fd);
+      errno = EINVAL;
+      return false;
+   }
+
+   map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED)
+      return false;
+
+   if (!pack_valid(map, (size_t)st.st_size)) {
+      munmap(map, (size_t)st.st_size);
+      errno = EINVAL;
+      return false;
+   }
+
+   pack->data = map;
+   pack->size = (size_t)st.st_size;
+   pack->count = pack_le_u32(pack->data + 8);
+   return true;
+}
+
+void pack_close(struct pack *pack)
+{
+   if (pack->data)
+      munmap((void *)pack->data, pack->size);
+   pack->data = NULL;
+   pack->size = 0;
+   pack->count = 0;
+}
+
+const uint8_t *pack_find(const struct pack *pack, const char *name, size_t *size)
+{
+   for (uint32_t i = 0; i < pack->count; i++) {
+      const uint8_t *entry = pack->data + PACK_HEADER_SIZE + i * PACK_ENTRY_SIZE;
+
+      if (strncmp((const char *)entry, name, PACK_NAME_SIZE) == 0) {
+         *size = pack_le_u32(entry + PACK_NAME_SIZE + 4);
+         return pack->data + pack_le_u32(entry + PACK_NAME_SIZE);
+      }
+   }
+
+   return NULL;
+}
@@ -0,0 +1,41 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Asset packs: named assets in one file that is mapped read-only, so
+ * only the assets in use are ever paged in. tools/mkpack writes them.
+ *
+ * Layout, all integers little-endian:
+ *   header   PACK_MAGIC, u32 entry count, u32 reserved
+ *   entries  count x { char name[PACK_NAME_SIZE], u32 offset, u32 size }
+ *   data     every asset starts on a PACK_ALIGN boundary
+ *
+ * Names are NUL padded and use the embedded asset file names, e.g.
+ * "grid_60.idx8" or "Left.wav". */
+#define PACK_FILE_NAME "avtest.pack"
+#define PACK_MAGIC "AVTPACK1"
+#define PACK_NAME_SIZE 48
+#define PACK_HEADER_SIZE 16
+#define PACK_ENTRY_SIZE (PACK_NAME_SIZE + 8)
+#define PACK_ALIGN 64
+
+/* An open pack; all zero when none is */
+struct pack {
+   const uint8_t *data;
+   size_t size;
+   uint32_t count;
+};
+
+/* Maps the pack at path, replacing any open one. On failure errno is
+ * ENOENT for a missing file and EINVAL for a malformed one. */
+bool pack_open(struct pack *pack, const char *path);
+void pack_close(struct pack *pack);
+
+/* Returns the named asset and its size, or NULL if the pack (or no
+ * open pack) has it. */
+const uint8_t *pack_find(const struct pack *pack, const char *name, size_t *size);
+
+#endif
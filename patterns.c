@@ -0,0 +1,316 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "patterns.h"
+
+#define RGB(r, g, b) (((uint32_t)(r) << 16) | ((uint32_t)(g) << 8) | (uint32_t)(b))
+#define GRAY(v) RGB(v, v, v)
+
+#define CHECKER_SIZE 16
+#define CROSSHATCH_STEP 32
+
+struct canvas {
+   uint8_t *buf;
+   size_t pitch;
+   unsigned width;
+   unsigned height;
+   const struct pixel_lut *lut;
+   uint8_t (*rows)[CAL_MAX_WIDTH];  /* two template rows */
+};
+
+/* Position num/den of the way across a length */
+static unsigned frac(unsigned length, unsigned num, unsigned den)
+{
+   return (unsigned)((uint64_t)length * num / den);
+}
+
+static void span(uint8_t *row, unsigned x0, unsigned x1, uint8_t index)
+{
+   if (x1 > x0)
+      memset(row + x0, index, x1 - x0);
+}
+
+static void put_row(const struct canvas *c, unsigned y, const uint8_t *indices)
+{
+   kernels.expand_idx8(c->buf + y * c->pitch, indices, c->width, c->lut);
+}
+
+/* Repeats rows [first, first + period) until rows rows are filled */
+static void repeat_rows(const struct canvas *c, unsigned first, unsigned period, unsigned rows)
+{
+   if (rows > period)
+      frame_repeat(c->buf + first * c->pitch, period * c->pitch, rows * c->pitch,
+                   c->pitch * c->height);
+}
+
+/* Rows [y0, y1) all equal to one template row */
+static void band(const struct canvas *c, unsigned y0, unsigned y1, const uint8_t *indices)
+{
+   if (y1 <= y0)
+      return;
+   put_row(c, y0, indices);
+   repeat_rows(c, y0, 1, y1 - y0);
+}
+
+/* SMPTE EG 1 bars: 75% bars over 2/3 of the height, the reversed blue
+ * row, then -I, white, +Q, black and a PLUGE (black, +2%, +4%). */
+enum {
+   SMPTE_GRAY, SMPTE_YELLOW, SMPTE_CYAN, SMPTE_GREEN, SMPTE_MAGENTA, SMPTE_RED,
+   SMPTE_BLUE, SMPTE_BLACK, SMPTE_WHITE, SMPTE_MINUS_I, SMPTE_PLUS_Q,
+   SMPTE_PLUGE_2, SMPTE_PLUGE_4, SMPTE_COLORS
+};
+
+static const uint32_t smpte_palette[SMPTE_COLORS] = {
+   GRAY(191), RGB(191, 191, 0), RGB(0, 191, 191), RGB(0, 191, 0), RGB(191, 0, 191),
+   RGB(191, 0, 0), RGB(0, 0, 191), GRAY(0), GRAY(255), RGB(0, 33, 76), RGB(50, 0, 106),
+   GRAY(5), GRAY(10),
+};
+
+static void draw_smpte_bars(const struct canvas *c)
+{
+   static const uint8_t top[7] = {
+      SMPTE_GRAY, SMPTE_YELLOW, SMPTE_CYAN, SMPTE_GREEN, SMPTE_MAGENTA, SMPTE_RED, SMPTE_BLUE,
+   };
+   static const uint8_t middle[7] = {
+      SMPTE_BLUE, SMPTE_BLACK, SMPTE_MAGENTA, SMPTE_BLACK, SMPTE_CYAN, SMPTE_BLACK, SMPTE_GRAY,
+   };
+   /* widths in 1/12 of a bar, 7 bars in all */
+   static const uint8_t bottom[][2] = {
+      { SMPTE_MINUS_I, 15 }, { SMPTE_WHITE, 15 }, { SMPTE_PLUS_Q, 15 }, { SMPTE_BLACK, 15 },
+      { SMPTE_BLACK, 4 }, { SMPTE_PLUGE_2, 4 }, { SMPTE_PLUGE_4, 4 }, { SMPTE_BLACK, 12 },
+   };
+   uint8_t *row = c->rows[0];
+   const unsigned y_middle = frac(c->height, 2, 3);
+   const unsigned y_bottom = frac(c->height, 3, 4);
+   unsigned pos = 0;
+
+   for (unsigned i = 0; i < 7; i++)
+      span(row, frac(c->width, i, 7), frac(c->width, i + 1, 7), top[i]);
+   band(c, 0, y_middle, row);
+
+   for (unsigned i = 0; i < 7; i++)
+      span(row, frac(c->width, i, 7), frac(c->width, i + 1, 7), middle[i]);
+   band(c, y_middle, y_bottom, row);
+
+   for (unsigned i = 0; i < sizeof(bottom) / sizeof(bottom[0]); i++) {
+      span(row, frac(c->width, pos, 84), frac(c->width, pos + bottom[i][1], 84), bottom[i][0]);
+      pos += bottom[i][1];
+   }
+   band(c, y_bottom, c->height, row);
+}
+
+/* EBU 100/0/75/0 bars: 100% white, then the 75% colors and black */
+static const uint32_t ebu_palette[8] = {
+   GRAY(255), RGB(191, 191, 0), RGB(0, 191, 191), RGB(0, 191, 0),
+   RGB(191, 0, 191), RGB(191, 0, 0), RGB(0, 0, 191), GRAY(0),
+};
+
+static void draw_ebu_bars(const struct canvas *c)
+{
+   uint8_t *row = c->rows[0];
+
+   for (unsigned i = 0; i < 8; i++)
+      span(row, frac(c->width, i, 8), frac(c->width, i + 1, 8), (uint8_t)i);
+   band(c, 0, c->height, row);
+}
+
+/* A continuous ramp over the top half and eleven 10% steps below it.
+ * The palette is the 256 gray levels, so an index is its level. */
+static void draw_gray_ramp(const struct canvas *c)
+{
+   uint8_t *row = c->rows[0];
+
+   for (unsigned x = 0; x < c->width; x++)
+      row[x] = (uint8_t)(c->width > 1 ? x * 255 / (c->width - 1) : 0);
+   band(c, 0, c->height / 2, row);
+
+   for (unsigned i = 0; i < 11; i++)
+      span(row, frac(c->width, i, 11), frac(c->width, i + 1, 11), (uint8_t)((i * 255 + 5) / 10));
+   band(c, c->height / 2, c->height, row);
+}
+
+/* Solid patches for gamma 1.8, 2.0, 2.2, 2.4 and 2.6 on a field of
+ * alternating black and white lines, which averages to 50% of the
+ * light: the patch that blends into the lines gives the display gamma.
+ * Levels are 255 * 0.5^(1/gamma). */
+enum { GAMMA_BLACK, GAMMA_WHITE, GAMMA_FIRST_PATCH };
+
+#define GAMMA_PATCHES 5
+
+static const uint32_t gamma_palette[GAMMA_FIRST_PATCH + GAMMA_PATCHES] = {
+   GRAY(0), GRAY(255), GRAY(173), GRAY(180), GRAY(186), GRAY(191), GRAY(195),
+};
+
+static void draw_gamma_ramp(const struct canvas *c)
+{
+   /* the patch band starts on an even row to keep the line phase */
+   const unsigned y0 = (c->height / 3) & ~1u;
+   const unsigned y1 = (c->height - c->height / 3) & ~1u;
+   uint8_t *white = c->rows[0];
+   uint8_t *black = c->rows[1];
+
+   span(white, 0, c->width, GAMMA_WHITE);
+   span(black, 0, c->width, GAMMA_BLACK);
+   put_row(c, 0, white);
+   if (c->height > 1)
+      put_row(c, 1, black);
+   repeat_rows(c, 0, 2, c->height);
+
+   /* patches in every other slot of 2 * GAMMA_PATCHES + 1 */
+   for (unsigned p = 0; p < GAMMA_PATCHES; p++) {
+      const unsigned x0 = frac(c->width, 2 * p + 1, 2 * GAMMA_PATCHES + 1);
+      const unsigned x1 = frac(c->width, 2 * p + 2, 2 * GAMMA_PATCHES + 1);
+      span(white, x0, x1, (uint8_t)(GAMMA_FIRST_PATCH + p));
+      span(black, x0, x1, (uint8_t)(GAMMA_FIRST_PATCH + p));
+   }
+   if (y1 > y0) {
+      put_row(c, y0, white);
+      put_row(c, y0 + 1, black);
+      repeat_rows(c, y0, 2, y1 - y0);
+   }
+}
+
+/* Near-black bars (+1%, +2%, +4%) on black over the top half, and
+ * near-white bars (-1%, -2%, -4%) on white below it. */
+enum {
+   PLUGE_BLACK, PLUGE_B1, PLUGE_B2, PLUGE_B4,
+   PLUGE_WHITE, PLUGE_W1, PLUGE_W2, PLUGE_W4, PLUGE_COLORS
+};
+
+static const uint32_t pluge_palette[PLUGE_COLORS] = {
+   GRAY(0), GRAY(3), GRAY(5), GRAY(10), GRAY(255), GRAY(252), GRAY(250), GRAY(245),
+};
+
+static void draw_pluge(const struct canvas *c)
+{
+   uint8_t *row = c->rows[0];
+
+   for (unsigned half = 0; half < 2; half++) {
+      const uint8_t base = half == 0 ? PLUGE_BLACK : PLUGE_WHITE;
+
+      span(row, 0, c->width, base);
+      for (unsigned i = 0; i < 3; i++)
+         span(row, frac(c->width, 2 * i + 1, 7), frac(c->width, 2 * i + 2, 7), (uint8_t)(base + 1 + i));
+      band(c, half * (c->height / 2), half ? c->height : c->height / 2, row);
+   }
+}
+
+static const uint32_t mono_palette[2] = { GRAY(0), GRAY(255) };
+
+static void draw_checkerboard(const struct canvas *c)
+{
+   for (unsigned i = 0; i < 2; i++) {
+      uint8_t *row = c->rows[i];
+      for (unsigned x = 0; x < c->width; x += CHECKER_SIZE)
+         span(row, x, x + CHECKER_SIZE < c->width ? x + CHECKER_SIZE : c->width,
+              (uint8_t)(((x / CHECKER_SIZE) + i) & 1));
+   }
+
+   band(c, 0, c->height < CHECKER_SIZE ? c->height : CHECKER_SIZE, c->rows[0]);
+   if (c->height > CHECKER_SIZE) {
+      band(c, CHECKER_SIZE, c->height < 2 * CHECKER_SIZE ? c->height : 2 * CHECKER_SIZE,
+           c->rows[1]);
+      repeat_rows(c, 0, 2 * CHECKER_SIZE, c->height);
+   }
+}
+
+/* White lines every CROSSHATCH_STEP pixels through the center, plus a
+ * border, on black */
+static bool crosshatch_line(unsigned pos, unsigned length)
+{
+   return pos == 0 || pos == length - 1 ||
+          (pos + CROSSHATCH_STEP - (length / 2) % CROSSHATCH_STEP) % CROSSHATCH_STEP == 0;
+}
+
+static void draw_crosshatch(const struct canvas *c)
+{
+   uint8_t *dots = c->rows[0];
+   uint8_t *line = c->rows[1];
+
+   span(dots, 0, c->width, 0);
+   for (unsigned x = 0; x < c->width; x++) {
+      if (crosshatch_line(x, c->width))
+         dots[x] = 1;
+   }
+   span(line, 0, c->width, 1);
+
+   band(c, 0, c->height, dots);
+   for (unsigned y = 0; y < c->height; y++) {
+      if (crosshatch_line(y, c->height))
+         put_row(c, y, line);
+   }
+}
+
+unsigned calibration_palette(enum calibration_pattern pattern, uint32_t *colors)
+{
+   const uint32_t *table;
+   unsigned count;
+
+   switch (pattern) {
+      case CAL_SMPTE_BARS:
+         table = smpte_palette;
+         count = SMPTE_COLORS;
+         break;
+      case CAL_EBU_BARS:
+         table = ebu_palette;
+         count = 8;
+         break;
+      case CAL_GRAY_RAMP:
+         for (unsigned i = 0; i < 256; i++)
+            colors[i] = GRAY(i);
+         return 256;
+      case CAL_GAMMA_RAMP:
+         table = gamma_palette;
+         count = GAMMA_FIRST_PATCH + GAMMA_PATCHES;
+         break;
+      case CAL_PLUGE:
+         table = pluge_palette;
+         count = PLUGE_COLORS;
+         break;
+      case CAL_CHECKERBOARD:
+      case CAL_CROSSHATCH:
+      default:
+         table = mono_palette;
+         count = 2;
+         break;
+   }
+
+   memcpy(colors, table, count * sizeof(*colors));
+   return count;
+}
+
+void calibration_draw(enum calibration_pattern pattern, uint8_t *buf, size_t pitch,
+                      unsigned width, unsigned height, const struct pixel_lut *lut)
+{
+   uint8_t rows[2][CAL_MAX_WIDTH];
+   const struct canvas c = { buf, pitch, width > CAL_MAX_WIDTH ? CAL_MAX_WIDTH : width, height, lut,
+                             rows };
+
+   if (c.height == 0)
+      return;
+
+   switch (pattern) {
+      case CAL_SMPTE_BARS:
+         draw_smpte_bars(&c);
+         break;
+      case CAL_EBU_BARS:
+         draw_ebu_bars(&c);
+         break;
+      case CAL_GRAY_RAMP:
+         draw_gray_ramp(&c);
+         break;
+      case CAL_GAMMA_RAMP:
+         draw_gamma_ramp(&c);
+         break;
+      case CAL_PLUGE:
+         draw_pluge(&c);
+         break;
+      case CAL_CHECKERBOARD:
+         draw_checkerboard(&c);
+         break;
+      case CAL_CROSSHATCH:
+      default:
+         draw_crosshatch(&c);
+         break;
+   }
+}
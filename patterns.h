@@ -0,0 +1,37 @@
+#ifndef PATTERNS_H
+#define PATTERNS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kernels.h"
+
+/* Calibration patterns. Each one is a palette plus rows of 8-bit indices
+ * into it: a few template rows are filled span by span, expanded to
+ * pixels once and then copied down the frame (frame_repeat), so
+ * drawing costs a handful of memset and copy calls and expand_idx8 runs
+ * rather than a per-pixel loop. Colors are full-range RGB (0 is black, 255 white). */
+enum calibration_pattern {
+   CAL_SMPTE_BARS = 0,
+   CAL_EBU_BARS,
+   CAL_GRAY_RAMP,
+   CAL_GAMMA_RAMP,
+   CAL_PLUGE,
+   CAL_CHECKERBOARD,
+   CAL_CROSSHATCH,
+   CAL_COUNT
+};
+
+/* Widest frame the patterns are drawn at */
+#define CAL_MAX_WIDTH 1920
+
+/* Writes the pattern's XRGB8888 palette (up to 256 entries) to colors
+ * and returns its size. */
+unsigned calibration_palette(enum calibration_pattern pattern, uint32_t *colors);
+
+/* Draws the pattern with lut, built from calibration_palette(), into a
+ * width x height frame whose rows are pitch bytes apart. */
+void calibration_draw(enum calibration_pattern pattern, uint8_t *buf, size_t pitch,
+                      unsigned width, unsigned height, const struct pixel_lut *lut);
+
+#endif
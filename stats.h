@@ -0,0 +1,29 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/* Live statistics. The core exposes this block as RETRO_MEMORY_SYSTEM_RAM
+ * and describes it with SET_MEMORY_MAPS, so memory viewers and external
+ * tools can watch it while the core runs; the core only ever updates the
+ * fields in place. The layout is fixed: little-endian, no padding, new
+ * fields only at the end with a new STATS_VERSION. */
+#define STATS_MAGIC 0x54535641u /* "AVST" */
+#define STATS_VERSION 1
+
+/* 1 ms per bucket, the last one also takes everything longer */
+#define STATS_FRAME_TIME_BUCKETS 64
+
+struct avtest_stats {
+   uint32_t magic;
+   uint32_t version;
+   uint64_t frames;                  /* retro_run() calls */
+   uint64_t audio_frames;            /* stereo frames sent to the frontend */
+   uint32_t audio_underruns;         /* buffer status reports of a likely underrun */
+   uint32_t audio_short_writes;      /* batches the frontend took only part of */
+   uint32_t audio_buffer_occupancy;  /* percent, from the last buffer status report */
+   uint32_t frame_time_usec;         /* last frame time callback delta */
+   uint32_t frame_time_hist[STATS_FRAME_TIME_BUCKETS];
+};
+
+#endif
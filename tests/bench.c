@@ -0,0 +1,299 @@
+/* Microbenchmarks for the core's hot functions.
+ *
+ * The core is compiled into this program so the static helpers can be
+ * timed directly. Every case runs a warmup, then a number of timed
+ * repetitions of a fixed batch of calls, and reports ns per call as the
+ * median and 99th percentile over the repetitions.
+ */
+
+#include "../avtest_libretro.c"
+
+#define BENCH_WARMUP 200
+#define BENCH_REPS 1000
+
+struct bench_case {
+   const char *name;
+   unsigned batch;
+   void (*setup)(void);
+   void (*body)(void);
+};
+
+static int16_t bench_audio_out[(48000 / 50 + 2) * 2];
+static int16_t bench_audio_up[(48000 / 50 + 2) * 2 * 4];
+static volatile uint64_t bench_sink;
+
+static bool bench_environment(unsigned cmd, void *data)
+{
+   switch (cmd) {
+      case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
+         return true;
+      case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE:
+         *(bool *)data = false;
+         return true;
+      default:
+         return false;
+   }
+}
+
+static void bench_video(const void *data, unsigned width, unsigned height, size_t pitch)
+{
+   (void)width;
+   (void)height;
+   (void)pitch;
+   bench_sink += (uintptr_t)data;
+}
+
+static size_t bench_audio_batch(const int16_t *data, size_t frames)
+{
+   bench_sink += (uint64_t)data[0] + frames;
+   return frames;
+}
+
+static void bench_input_poll(void)
+{
+}
+
+static int16_t bench_input_state(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+   (void)port;
+   (void)device;
+   (void)index;
+   (void)id;
+   return 0;
+}
+
+static uint64_t now_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+   double x = *(const double *)a;
+   double y = *(const double *)b;
+   return (x > y) - (x < y);
+}
+
+/* Every setup starts from the 60 Hz grid without overlay. The embedded
+ * WAVs are mono, so the stereo case reinterprets the left WAV as
+ * interleaved stereo; only the loop cost matters here. */
+static void setup_audio_common(void)
+{
+   core.audio_stress_rate = 0;
+   core.audio_batch_size = 1;
+   core.audio_source = AUDIO_SOURCE_ALTERNATE;
+   audio_init(&core);
+   core.audio_paused = false;
+   core.is_50hz = false;
+   core.resolution_width = 0;
+   core.resolution_height = 0;
+   core.overlay_enabled = false;
+   core.test_pattern = PATTERN_GRID;
+}
+
+static void setup_stereo(void)
+{
+   setup_audio_common();
+   core.left_wav_data.frames /= 2;
+   core.left_wav_data.channels = 2;
+   core.audio_use_stereo = true;
+   core.audio_sequential = false;
+}
+
+static void setup_sequential(void)
+{
+   setup_audio_common();
+   core.audio_use_stereo = false;
+   core.audio_sequential = true;
+}
+
+static void setup_dual_mono(void)
+{
+   setup_audio_common();
+   core.audio_use_stereo = false;
+   core.audio_sequential = false;
+   core.audio_has_right = true;
+}
+
+static void setup_mix(void)
+{
+   setup_audio_common();
+   core.audio_source = AUDIO_SOURCE_MIX;
+   audio_init(&core);
+}
+
+static void setup_stress(void)
+{
+   setup_audio_common();
+   core.audio_stress_rate = AUDIO_MAX_STRESS_RATE;
+   core.audio_batch_size = AUDIO_MAX_BATCH;
+   audio_init(&core);
+}
+
+static void setup_paused(void)
+{
+   setup_audio_common();
+   core.audio_paused = true;
+}
+
+static void setup_overlay(void)
+{
+   setup_audio_common();
+   core.overlay_enabled = true;
+   build_glyph_atlas(&core);
+}
+
+static void setup_moving_bar(void)
+{
+   setup_audio_common();
+   core.test_pattern = PATTERN_MOVING_BAR;
+}
+
+static void setup_scroll(void)
+{
+   setup_audio_common();
+   core.test_pattern = PATTERN_SCROLL;
+   load_bg(&core);
+}
+
+static void setup_smpte_bars(void)
+{
+   setup_audio_common();
+   core.test_pattern = PATTERN_SMPTE_BARS;
+}
+
+static void setup_gray_ramp(void)
+{
+   setup_audio_common();
+   core.test_pattern = PATTERN_GRAY_RAMP;
+}
+
+static void setup_1080p(void)
+{
+   setup_audio_common();
+   core.resolution_width = 1920;
+   core.resolution_height = 1080;
+}
+
+static void setup_1080p_bar(void)
+{
+   setup_1080p();
+   core.test_pattern = PATTERN_MOVING_BAR;
+   load_bg(&core);
+}
+
+static void setup_noise(void)
+{
+   setup_audio_common();
+   set_test_pattern(&core, PATTERN_NOISE);
+}
+
+static void setup_1080p_noise(void)
+{
+   setup_1080p();
+   set_test_pattern(&core, PATTERN_NOISE);
+}
+
+static void body_load_bg_60(void)
+{
+   core.is_50hz = false;
+   load_bg(&core);
+}
+
+static void body_load_bg_50(void)
+{
+   core.is_50hz = true;
+   load_bg(&core);
+}
+
+static void body_audio_generate(void)
+{
+   audio_generate(&core, bench_audio_out, 800);
+}
+
+static void body_upsample_x4(void)
+{
+   kernels.upsample_s16(bench_audio_up, bench_audio_out, 800, 4);
+}
+
+static void body_cycle_palette(void)
+{
+   cycle_palette(&core);
+}
+
+static void body_render_audio(void)
+{
+   render_audio(&core);
+}
+
+static void body_retro_run(void)
+{
+   retro_run();
+}
+
+static const struct bench_case bench_cases[] = {
+   { "load_bg(60Hz)",                1, setup_overlay,      body_load_bg_60 },
+   { "load_bg(50Hz)",                1, setup_overlay,      body_load_bg_50 },
+   { "load_bg(bar)",                 1, setup_moving_bar,   body_load_bg_60 },
+   { "load_bg(smpte_bars)",          1, setup_smpte_bars,   body_load_bg_60 },
+   { "load_bg(gray_ramp)",           1, setup_gray_ramp,    body_load_bg_60 },
+   { "load_bg(1080p)",               1, setup_1080p,        body_load_bg_60 },
+   { "cycle_palette",                1, setup_audio_common, body_cycle_palette },
+   { "audio_generate(stereo,800)",  16, setup_stereo,       body_audio_generate },
+   { "audio_generate(seq,800)",     16, setup_sequential,   body_audio_generate },
+   { "audio_generate(mono,800)",    16, setup_dual_mono,    body_audio_generate },
+   { "audio_generate(paused,800)",  16, setup_paused,       body_audio_generate },
+   { "audio_generate(mix,800)",     16, setup_mix,          body_audio_generate },
+   { "upsample_s16(x4,800)",        16, setup_sequential,   body_upsample_x4 },
+   { "render_audio",                16, setup_sequential,   body_render_audio },
+   { "render_audio(192k,batch 8)",  16, setup_stress,       body_render_audio },
+   { "retro_run",                   16, setup_sequential,   body_retro_run },
+   { "retro_run(bar)",              16, setup_moving_bar,   body_retro_run },
+   { "retro_run(scroll)",           16, setup_scroll,       body_retro_run },
+   { "retro_run(1080p bar)",        16, setup_1080p_bar,    body_retro_run },
+   { "retro_run(noise)",            16, setup_noise,        body_retro_run },
+   { "retro_run(1080p noise)",      16, setup_1080p_noise,  body_retro_run },
+};
+
+int main(int argc, char **argv)
+{
+   static double samples[BENCH_REPS];
+   const char *filter = argc > 1 ? argv[1] : NULL;
+
+   retro_set_environment(bench_environment);
+   retro_set_video_refresh(bench_video);
+   retro_set_audio_sample_batch(bench_audio_batch);
+   retro_set_input_poll(bench_input_poll);
+   retro_set_input_state(bench_input_state);
+   retro_init();
+
+   printf("%-28s %12s %12s\n", "case", "median ns", "p99 ns");
+
+   for (size_t c = 0; c < sizeof(bench_cases) / sizeof(bench_cases[0]); c++) {
+      const struct bench_case *bc = &bench_cases[c];
+
+      if (filter && !strstr(bc->name, filter))
+         continue;
+
+      bc->setup();
+
+      for (unsigned i = 0; i < BENCH_WARMUP; i++)
+         bc->body();
+
+      for (unsigned r = 0; r < BENCH_REPS; r++) {
+         uint64_t start = now_ns();
+         for (unsigned i = 0; i < bc->batch; i++)
+            bc->body();
+         samples[r] = (double)(now_ns() - start) / bc->batch;
+      }
+
+      qsort(samples, BENCH_REPS, sizeof(samples[0]), compare_double);
+      printf("%-28s %12.1f %12.1f\n", bc->name,
+             samples[BENCH_REPS / 2], samples[BENCH_REPS * 99 / 100]);
+   }
+
+   retro_deinit();
+   return 0;
+}
@@ -0,0 +1,906 @@
+/* Headless reference frontend for avtest_libretro.so.
+ *
+ * Loads the core with dlopen, implements the environment, video, audio
+ * and input callbacks, runs a scripted number of frames and hashes every
+ * submitted frame and audio sample. Scripts may carry the expected hashes,
+ * in which case a mismatch makes the run fail.
+ *
+ * With --check-alloc the C allocator is interposed and any allocation or
+ * free made by the core inside retro_run() fails the run.
+ *
+ * With --capture the video and audio the frontend receives are written
+ * as a raw video dump and a WAV file, the input of tools/avanalyze.
+ *
+ * At the end of every run the core's statistics block (stats.h), found
+ * through SET_MEMORY_MAPS and retro_get_memory_data(), has to agree with
+ * what this frontend counted.
+ *
+ * Script format, one statement per line ('#' starts a comment):
+ *
+ *   frames <count>
+ *   pixel_formats <list>              formats the frontend accepts,
+ *                                     e.g. rgb565 (default: xrgb8888+rgb565)
+ *   system_dir <path>                 system directory reported to the core
+ *   input <frame> <port> <buttons>    buttons: A+B, START, none, ...
+ *   option <frame> <key> <value>      sets a core option from that frame on
+ *   option load <key> <value>         sets a core option before loading
+ *   drop <frame>                      the capture misses that frame
+ *   repeat <frame>                    the capture shows that frame twice
+ *   audio_delay <frames>              the captured audio starts that many
+ *                                     frames of silence late
+ *   expect video <hash>
+ *   expect audio <hash>
+ *   expect av_info <count>            SET_SYSTEM_AV_INFO calls
+ *   expect geometry <count>           SET_GEOMETRY calls
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "../libretro.h"
+#include "../stats.h"
+
+#define MAX_PORTS 8
+#define MAX_EVENTS 1024
+#define MAX_OPTIONS 32
+#define MAX_OPTION_EVENTS 64
+#define MAX_CAPTURE_EVENTS 64
+#define OPTION_TEXT 256
+#define FNV_OFFSET 1469598103934665603ULL
+#define FNV_PRIME 1099511628211ULL
+
+struct input_event {
+   unsigned frame;
+   unsigned port;
+   uint16_t buttons;
+};
+
+struct option_event {
+   unsigned frame;
+   bool at_load;
+   char key[OPTION_TEXT];
+   char value[OPTION_TEXT];
+};
+
+struct capture_event {
+   unsigned frame;
+   unsigned copies;
+};
+
+struct script {
+   unsigned frames;
+   struct input_event events[MAX_EVENTS];
+   unsigned num_events;
+   struct option_event option_events[MAX_OPTION_EVENTS];
+   unsigned num_option_events;
+   struct capture_event capture_events[MAX_CAPTURE_EVENTS];
+   unsigned num_capture_events;
+   unsigned audio_delay;
+   bool has_video_hash;
+   bool has_audio_hash;
+   bool has_av_info_calls;
+   bool has_geometry_calls;
+   uint64_t video_hash;
+   uint64_t audio_hash;
+   unsigned av_info_calls;
+   unsigned geometry_calls;
+   bool accept_xrgb8888;
+   bool accept_rgb565;
+   char system_dir[256];
+};
+
+struct core {
+   void *handle;
+   void (*set_environment)(retro_environment_t);
+   void (*set_video_refresh)(retro_video_refresh_t);
+   void (*set_audio_sample)(retro_audio_sample_t);
+   void (*set_audio_sample_batch)(retro_audio_sample_batch_t);
+   void (*set_input_poll)(retro_input_poll_t);
+   void (*set_input_state)(retro_input_state_t);
+   void (*init)(void);
+   void (*deinit)(void);
+   bool (*load_game)(const struct retro_game_info *);
+   void (*unload_game)(void);
+   void (*run)(void);
+   void (*get_system_av_info)(struct retro_system_av_info *);
+   void *(*get_memory_data)(unsigned);
+   size_t (*get_memory_size)(unsigned);
+};
+
+static const char *button_names[] = {
+   "B", "Y", "SELECT", "START", "UP", "DOWN", "LEFT", "RIGHT",
+   "A", "X", "L", "R", "L2", "R2", "L3", "R3",
+};
+
+static bool verbose = false;
+static bool quiet = false;
+static bool use_bitmasks = true;
+static const char *system_dir = ".";
+static bool system_dir_given = false;
+
+static enum retro_pixel_format pixel_format = RETRO_PIXEL_FORMAT_0RGB1555;
+static bool accept_xrgb8888 = true;
+static bool accept_rgb565 = true;
+static unsigned run_pixel_formats = 0;
+static struct retro_frame_time_callback frame_time;
+static bool have_frame_time = false;
+static uint16_t port_buttons[MAX_PORTS];
+static unsigned current_frame = 0;
+
+/* Core options declared with SET_CORE_OPTIONS_V2 */
+struct option {
+   char key[OPTION_TEXT];
+   char value[OPTION_TEXT];
+};
+
+static struct option options[MAX_OPTIONS];
+static unsigned num_options = 0;
+static bool options_updated = false;
+static unsigned av_info_calls = 0;
+static unsigned geometry_calls = 0;
+static const struct avtest_stats *mapped_stats = NULL;
+static uint64_t frame_time_calls = 0;
+
+static bool check_alloc = false;
+static bool in_core_run = false;
+static bool in_run = false;
+static unsigned frontend_depth = 0;
+static uint64_t run_allocs = 0;
+static uint64_t run_frees = 0;
+static long first_alloc_frame = -1;
+
+static uint64_t video_hash = FNV_OFFSET;
+static uint64_t audio_hash = FNV_OFFSET;
+static uint64_t video_frames = 0;
+static uint64_t video_dupes = 0;
+static uint64_t audio_frames = 0;
+static unsigned last_width = 0;
+static unsigned last_height = 0;
+
+/* The last frame has to stay valid until the next retro_run(): a
+ * frontend may show it again, e.g. to dupe it or for runahead. */
+static const void *kept_frame = NULL;
+static size_t kept_pitch = 0;
+static uint64_t kept_hash = 0;
+static unsigned changed_frames = 0;
+static long first_changed_frame = -1;
+
+/* --capture: what reached the frontend, as a capture device would
+ * record it. Dupes show the last frame again. */
+static FILE *capture_video = NULL;
+static FILE *capture_audio = NULL;
+static uint8_t *capture_frame = NULL;
+static size_t capture_frame_size = 0;
+static unsigned capture_copies = 1;
+static uint64_t capture_audio_bytes = 0;
+static bool capture_failed = false;
+
+/* Allocation counting. Calls made from within this frontend's own
+ * callbacks are not charged to the core. */
+#define FRONTEND_ENTER() (frontend_depth++)
+#define FRONTEND_LEAVE() (frontend_depth--)
+
+static void note_alloc_call(bool is_free)
+{
+   if (!in_core_run || frontend_depth > 0)
+      return;
+
+   if (is_free)
+      run_frees++;
+   else
+      run_allocs++;
+
+   if (first_alloc_frame < 0)
+      first_alloc_frame = current_frame;
+}
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+   note_alloc_call(false);
+   return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+   note_alloc_call(false);
+   return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+   note_alloc_call(false);
+   return __libc_realloc(ptr, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+   note_alloc_call(false);
+   return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size)
+{
+   note_alloc_call(false);
+   *out = __libc_memalign(alignment, size);
+   return *out ? 0 : ENOMEM;
+}
+
+void free(void *ptr)
+{
+   if (ptr)
+      note_alloc_call(true);
+   __libc_free(ptr);
+}
+#define HAVE_ALLOC_HOOKS 1
+#endif
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+   const uint8_t *bytes = data;
+
+   for (size_t i = 0; i < size; i++) {
+      hash ^= bytes[i];
+      hash *= FNV_PRIME;
+   }
+   return hash;
+}
+
+static void log_printf(enum retro_log_level level, const char *fmt, ...)
+{
+   if (quiet && level < RETRO_LOG_WARN)
+      return;
+
+   va_list args;
+   FRONTEND_ENTER();
+   va_start(args, fmt);
+   vfprintf(stderr, fmt, args);
+   va_end(args);
+   FRONTEND_LEAVE();
+}
+
+static struct option *find_option(const char *key)
+{
+   for (unsigned i = 0; i < num_options; i++) {
+      if (strcmp(options[i].key, key) == 0)
+         return &options[i];
+   }
+   return NULL;
+}
+
+static void declare_options(const struct retro_core_options_v2 *opts)
+{
+   num_options = 0;
+   for (const struct retro_core_option_v2_definition *def = opts->definitions;
+        def->key && num_options < MAX_OPTIONS; def++) {
+      struct option *opt = &options[num_options++];
+      snprintf(opt->key, sizeof(opt->key), "%s", def->key);
+      snprintf(opt->value, sizeof(opt->value), "%s",
+               def->default_value ? def->default_value : def->values[0].value);
+   }
+}
+
+static bool set_option(const char *script_path, const struct option_event *ev)
+{
+   struct option *opt = find_option(ev->key);
+
+   if (!opt) {
+      fprintf(stderr, "%s: core has no option %s\n", script_path, ev->key);
+      return false;
+   }
+   snprintf(opt->value, sizeof(opt->value), "%s", ev->value);
+   options_updated = true;
+   return true;
+}
+
+static bool environment(unsigned cmd, void *data)
+{
+   switch (cmd) {
+      case RETRO_ENVIRONMENT_GET_LOG_INTERFACE:
+         ((struct retro_log_callback *)data)->log = log_printf;
+         return true;
+      case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT: {
+         enum retro_pixel_format fmt = *(const enum retro_pixel_format *)data;
+         /* Only allowed in retro_load_game() and retro_get_system_av_info() */
+         if (in_run) {
+            run_pixel_formats++;
+            return false;
+         }
+         if (!(fmt == RETRO_PIXEL_FORMAT_XRGB8888 && accept_xrgb8888) &&
+             !(fmt == RETRO_PIXEL_FORMAT_RGB565 && accept_rgb565))
+            return false;
+         pixel_format = fmt;
+         return true;
+      }
+      case RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY:
+         *(const char **)data = system_dir;
+         return true;
+      case RETRO_ENVIRONMENT_GET_INPUT_BITMASKS:
+         return use_bitmasks;
+      case RETRO_ENVIRONMENT_GET_INPUT_MAX_USERS:
+         *(unsigned *)data = MAX_PORTS;
+         return true;
+      case RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK:
+         frame_time = *(const struct retro_frame_time_callback *)data;
+         have_frame_time = frame_time.callback != NULL;
+         return true;
+      case RETRO_ENVIRONMENT_GET_CORE_OPTIONS_VERSION:
+         *(unsigned *)data = 2;
+         return true;
+      case RETRO_ENVIRONMENT_SET_CORE_OPTIONS_V2:
+         declare_options(data);
+         return true;
+      case RETRO_ENVIRONMENT_GET_VARIABLE: {
+         struct retro_variable *var = data;
+         struct option *opt = find_option(var->key);
+         var->value = opt ? opt->value : NULL;
+         return opt != NULL;
+      }
+      case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE:
+         *(bool *)data = options_updated;
+         options_updated = false;
+         return true;
+      case RETRO_ENVIRONMENT_SET_GEOMETRY:
+         geometry_calls++;
+         return true;
+      case RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO:
+         av_info_calls++;
+         return true;
+      case RETRO_ENVIRONMENT_SET_MEMORY_MAPS: {
+         const struct retro_memory_map *map = data;
+         mapped_stats = NULL;
+         for (unsigned i = 0; i < map->num_descriptors; i++) {
+            const struct retro_memory_descriptor *desc = &map->descriptors[i];
+            if ((desc->flags & RETRO_MEMDESC_SYSTEM_RAM) && desc->len >= sizeof(*mapped_stats))
+               mapped_stats = (const struct avtest_stats *)((const uint8_t *)desc->ptr + desc->offset);
+         }
+         return true;
+      }
+      case RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS:
+      case RETRO_ENVIRONMENT_SET_CONTROLLER_INFO:
+      case RETRO_ENVIRONMENT_SET_FASTFORWARDING_OVERRIDE: /* never throttled */
+         return true;
+      default:
+         return false;
+   }
+}
+
+static uint64_t hash_frame(const void *data, unsigned width, unsigned height, size_t pitch)
+{
+   size_t bpp = pixel_format == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2;
+   uint64_t hash = FNV_OFFSET;
+
+   hash = fnv1a(hash, &width, sizeof(width));
+   hash = fnv1a(hash, &height, sizeof(height));
+   for (unsigned y = 0; y < height; y++)
+      hash = fnv1a(hash, (const uint8_t *)data + y * pitch, width * bpp);
+   return hash;
+}
+
+static void capture_video_frame(const void *data, unsigned width, unsigned height, size_t pitch)
+{
+   size_t row = (size_t)width * (pixel_format == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2);
+
+   FRONTEND_ENTER();
+   if (data) {
+      if (capture_frame_size != row * height) {
+         free(capture_frame);
+         capture_frame_size = row * height;
+         if (!(capture_frame = malloc(capture_frame_size))) {
+            capture_frame_size = 0;
+            capture_failed = true;
+         }
+      }
+      for (unsigned y = 0; y < height && capture_frame; y++)
+         memcpy(capture_frame + y * row, (const uint8_t *)data + y * pitch, row);
+   }
+   for (unsigned i = 0; i < capture_copies && capture_frame; i++)
+      fwrite(capture_frame, 1, capture_frame_size, capture_video);
+   FRONTEND_LEAVE();
+}
+
+static void video_refresh(const void *data, unsigned width, unsigned height, size_t pitch)
+{
+   if (capture_video)
+      capture_video_frame(data, width, height, pitch);
+
+   if (!data) {
+      video_dupes++;
+      video_hash = fnv1a(video_hash, "dupe", 4);
+      return;
+   }
+
+   uint64_t frame_hash = hash_frame(data, width, height, pitch);
+
+   if (verbose) {
+      FRONTEND_ENTER();
+      printf("frame %u %ux%u %016llx\n", current_frame, width, height,
+             (unsigned long long)frame_hash);
+      FRONTEND_LEAVE();
+   }
+
+   video_hash = fnv1a(video_hash, &frame_hash, sizeof(frame_hash));
+   video_frames++;
+   last_width = width;
+   last_height = height;
+
+   kept_frame = data;
+   kept_pitch = pitch;
+   kept_hash = frame_hash;
+}
+
+static size_t audio_sample_batch(const int16_t *data, size_t frames)
+{
+   audio_hash = fnv1a(audio_hash, data, frames * 2 * sizeof(int16_t));
+   audio_frames += frames;
+
+   if (capture_audio) {
+      FRONTEND_ENTER();
+      fwrite(data, 2 * sizeof(int16_t), frames, capture_audio);
+      capture_audio_bytes += frames * 2 * sizeof(int16_t);
+      FRONTEND_LEAVE();
+   }
+   return frames;
+}
+
+static void audio_sample(int16_t left, int16_t right)
+{
+   int16_t frame[2] = { left, right };
+   audio_sample_batch(frame, 1);
+}
+
+static void input_poll(void)
+{
+}
+
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+   if (port >= MAX_PORTS || device != RETRO_DEVICE_JOYPAD || index != 0)
+      return 0;
+
+   if (id == RETRO_DEVICE_ID_JOYPAD_MASK)
+      return (int16_t)port_buttons[port];
+
+   if (id >= 16)
+      return 0;
+
+   return (port_buttons[port] >> id) & 1;
+}
+
+static bool parse_buttons(const char *text, uint16_t *out)
+{
+   char buf[256];
+   uint16_t buttons = 0;
+
+   snprintf(buf, sizeof(buf), "%s", text);
+   if (strcasecmp(buf, "none") == 0 || strcmp(buf, "-") == 0) {
+      *out = 0;
+      return true;
+   }
+
+   for (char *tok = strtok(buf, "+"); tok; tok = strtok(NULL, "+")) {
+      unsigned id;
+      for (id = 0; id < 16; id++) {
+         if (strcasecmp(tok, button_names[id]) == 0)
+            break;
+      }
+      if (id == 16)
+         return false;
+      buttons |= 1 << id;
+   }
+
+   *out = buttons;
+   return true;
+}
+
+static bool load_script(const char *path, struct script *script)
+{
+   FILE *fp = fopen(path, "r");
+   char line[512];
+   unsigned line_no = 0;
+
+   if (!fp) {
+      fprintf(stderr, "%s: cannot open script\n", path);
+      return false;
+   }
+
+   memset(script, 0, sizeof(*script));
+   script->frames = 600;
+   script->accept_xrgb8888 = true;
+   script->accept_rgb565 = true;
+
+   while (fgets(line, sizeof(line), fp)) {
+      char word[64], arg1[256], arg2[64], arg3[256];
+      char *comment = strchr(line, '#');
+      int n;
+
+      line_no++;
+      if (comment)
+         *comment = '\0';
+
+      n = sscanf(line, "%63s %255s %63s %255s", word, arg1, arg2, arg3);
+      if (n <= 0)
+         continue;
+
+      if (strcmp(word, "frames") == 0 && n == 2) {
+         script->frames = (unsigned)strtoul(arg1, NULL, 0);
+      } else if (strcmp(word, "pixel_formats") == 0 && n == 2) {
+         script->accept_xrgb8888 = strstr(arg1, "xrgb8888") != NULL;
+         script->accept_rgb565 = strstr(arg1, "rgb565") != NULL;
+      } else if (strcmp(word, "system_dir") == 0 && n == 2) {
+         snprintf(script->system_dir, sizeof(script->system_dir), "%s", arg1);
+      } else if (strcmp(word, "input") == 0 && n == 4) {
+         if (script->num_events == MAX_EVENTS)
+            goto error;
+         struct input_event *ev = &script->events[script->num_events];
+         ev->frame = (unsigned)strtoul(arg1, NULL, 0);
+         ev->port = (unsigned)strtoul(arg2, NULL, 0);
+         if (ev->port >= MAX_PORTS || !parse_buttons(arg3, &ev->buttons))
+            goto error;
+         script->num_events++;
+      } else if (strcmp(word, "option") == 0 && n == 4) {
+         if (script->num_option_events == MAX_OPTION_EVENTS)
+            goto error;
+         struct option_event *ev = &script->option_events[script->num_option_events++];
+         ev->at_load = strcmp(arg1, "load") == 0;
+         ev->frame = ev->at_load ? 0 : (unsigned)strtoul(arg1, NULL, 0);
+         snprintf(ev->key, sizeof(ev->key), "%s", arg2);
+         snprintf(ev->value, sizeof(ev->value), "%s", arg3);
+      } else if ((strcmp(word, "drop") == 0 || strcmp(word, "repeat") == 0) && n == 2) {
+         if (script->num_capture_events == MAX_CAPTURE_EVENTS)
+            goto error;
+         struct capture_event *ev = &script->capture_events[script->num_capture_events++];
+         ev->frame = (unsigned)strtoul(arg1, NULL, 0);
+         ev->copies = strcmp(word, "drop") == 0 ? 0 : 2;
+      } else if (strcmp(word, "audio_delay") == 0 && n == 2) {
+         script->audio_delay = (unsigned)strtoul(arg1, NULL, 0);
+      } else if (strcmp(word, "expect") == 0 && n == 3 && strcmp(arg1, "video") == 0) {
+         script->video_hash = strtoull(arg2, NULL, 16);
+         script->has_video_hash = true;
+      } else if (strcmp(word, "expect") == 0 && n == 3 && strcmp(arg1, "audio") == 0) {
+         script->audio_hash = strtoull(arg2, NULL, 16);
+         script->has_audio_hash = true;
+      } else if (strcmp(word, "expect") == 0 && n == 3 && strcmp(arg1, "av_info") == 0) {
+         script->av_info_calls = (unsigned)strtoul(arg2, NULL, 0);
+         script->has_av_info_calls = true;
+      } else if (strcmp(word, "expect") == 0 && n == 3 && strcmp(arg1, "geometry") == 0) {
+         script->geometry_calls = (unsigned)strtoul(arg2, NULL, 0);
+         script->has_geometry_calls = true;
+      } else {
+         goto error;
+      }
+   }
+
+   fclose(fp);
+   return true;
+
+error:
+   fprintf(stderr, "%s:%u: invalid statement\n", path, line_no);
+   fclose(fp);
+   return false;
+}
+
+static bool load_core(const char *path, struct core *core)
+{
+   core->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+   if (!core->handle) {
+      fprintf(stderr, "%s\n", dlerror());
+      return false;
+   }
+
+#define LOAD_SYM(field, name) \
+   if (!(*(void **)&core->field = dlsym(core->handle, name))) { \
+      fprintf(stderr, "%s: missing symbol %s\n", path, name); \
+      return false; \
+   }
+
+   LOAD_SYM(set_environment, "retro_set_environment");
+   LOAD_SYM(set_video_refresh, "retro_set_video_refresh");
+   LOAD_SYM(set_audio_sample, "retro_set_audio_sample");
+   LOAD_SYM(set_audio_sample_batch, "retro_set_audio_sample_batch");
+   LOAD_SYM(set_input_poll, "retro_set_input_poll");
+   LOAD_SYM(set_input_state, "retro_set_input_state");
+   LOAD_SYM(init, "retro_init");
+   LOAD_SYM(deinit, "retro_deinit");
+   LOAD_SYM(load_game, "retro_load_game");
+   LOAD_SYM(unload_game, "retro_unload_game");
+   LOAD_SYM(run, "retro_run");
+   LOAD_SYM(get_system_av_info, "retro_get_system_av_info");
+   LOAD_SYM(get_memory_data, "retro_get_memory_data");
+   LOAD_SYM(get_memory_size, "retro_get_memory_size");
+#undef LOAD_SYM
+
+   return true;
+}
+
+/* Compares the core's statistics block with this frontend's counts */
+static bool check_stats(const struct core *core, const char *script_path, unsigned frames)
+{
+   const struct avtest_stats *stats = core->get_memory_data(RETRO_MEMORY_SYSTEM_RAM);
+   uint64_t timed = 0;
+
+   if (!stats || stats != mapped_stats ||
+       core->get_memory_size(RETRO_MEMORY_SYSTEM_RAM) != sizeof(*stats) ||
+       stats->magic != STATS_MAGIC || stats->version != STATS_VERSION) {
+      fprintf(stderr, "%s: no statistics block in the memory map\n", script_path);
+      return false;
+   }
+
+   for (unsigned i = 0; i < STATS_FRAME_TIME_BUCKETS; i++)
+      timed += stats->frame_time_hist[i];
+
+   if (stats->frames != frames || stats->audio_frames != audio_frames ||
+       timed != frame_time_calls || stats->audio_short_writes != 0) {
+      fprintf(stderr, "%s: statistics say %llu frames, %llu audio frames, %llu frame times, "
+              "%u short writes (expected %u, %llu, %llu, 0)\n", script_path,
+              (unsigned long long)stats->frames, (unsigned long long)stats->audio_frames,
+              (unsigned long long)timed, stats->audio_short_writes, frames,
+              (unsigned long long)audio_frames, (unsigned long long)frame_time_calls);
+      return false;
+   }
+
+   return true;
+}
+
+static bool capture_open(const char *prefix, unsigned delay)
+{
+   char path[4096];
+   static const uint8_t silence[4];
+
+   snprintf(path, sizeof(path), "%s.raw", prefix);
+   if (!(capture_video = fopen(path, "wb"))) {
+      fprintf(stderr, "%s: cannot create\n", path);
+      return false;
+   }
+   snprintf(path, sizeof(path), "%s.wav", prefix);
+   if (!(capture_audio = fopen(path, "wb"))) {
+      fprintf(stderr, "%s: cannot create\n", path);
+      return false;
+   }
+
+   /* The header is written once the data size is known */
+   fseek(capture_audio, 44, SEEK_SET);
+   for (unsigned i = 0; i < delay; i++)
+      fwrite(silence, 1, sizeof(silence), capture_audio);
+   capture_audio_bytes = (uint64_t)delay * sizeof(silence);
+   return true;
+}
+
+static void write_le(uint8_t *p, uint32_t value, unsigned bytes)
+{
+   for (unsigned i = 0; i < bytes; i++)
+      p[i] = (uint8_t)(value >> (i * 8));
+}
+
+/* 16-bit stereo PCM at the rate the core reported at load */
+static bool capture_close(const char *prefix, unsigned rate)
+{
+   uint8_t header[44];
+
+   memcpy(header, "RIFF", 4);
+   write_le(header + 4, (uint32_t)(36 + capture_audio_bytes), 4);
+   memcpy(header + 8, "WAVEfmt ", 8);
+   write_le(header + 16, 16, 4);
+   write_le(header + 20, 1, 2);
+   write_le(header + 22, 2, 2);
+   write_le(header + 24, rate, 4);
+   write_le(header + 28, rate * 4, 4);
+   write_le(header + 32, 4, 2);
+   write_le(header + 34, 16, 2);
+   memcpy(header + 36, "data", 4);
+   write_le(header + 40, (uint32_t)capture_audio_bytes, 4);
+
+   fseek(capture_audio, 0, SEEK_SET);
+   fwrite(header, 1, sizeof(header), capture_audio);
+
+   bool ok = !capture_failed && !ferror(capture_video) && !ferror(capture_audio);
+   ok = fclose(capture_video) == 0 && ok;
+   ok = fclose(capture_audio) == 0 && ok;
+   free(capture_frame);
+   if (!ok)
+      fprintf(stderr, "%s: cannot write the capture\n", prefix);
+   return ok;
+}
+
+static void usage(const char *prog)
+{
+   fprintf(stderr,
+           "Usage: %s [options] <core.so> <script>\n"
+           "  -f, --frames N     override the script's frame count\n"
+           "  -s, --system DIR   system directory reported to the core\n"
+           "  -n, --no-bitmasks  do not advertise GET_INPUT_BITMASKS\n"
+           "  -a, --check-alloc  fail if the core allocates inside retro_run()\n"
+           "  -c, --capture PREFIX  write the output to PREFIX.raw and PREFIX.wav\n"
+           "  -v, --verbose      print the hash of every frame\n"
+           "  -q, --quiet        only show core warnings and errors\n",
+           prog);
+}
+
+int main(int argc, char **argv)
+{
+   struct script script;
+   struct core core;
+   const char *core_path = NULL;
+   const char *script_path = NULL;
+   long frames_override = -1;
+   const char *capture_prefix = NULL;
+
+   for (int i = 1; i < argc; i++) {
+      if ((!strcmp(argv[i], "-f") || !strcmp(argv[i], "--frames")) && i + 1 < argc)
+         frames_override = strtol(argv[++i], NULL, 0);
+      else if ((!strcmp(argv[i], "-s") || !strcmp(argv[i], "--system")) && i + 1 < argc) {
+         system_dir = argv[++i];
+         system_dir_given = true;
+      } else if (!strcmp(argv[i], "-n") || !strcmp(argv[i], "--no-bitmasks"))
+         use_bitmasks = false;
+      else if (!strcmp(argv[i], "-a") || !strcmp(argv[i], "--check-alloc"))
+         check_alloc = true;
+      else if ((!strcmp(argv[i], "-c") || !strcmp(argv[i], "--capture")) && i + 1 < argc)
+         capture_prefix = argv[++i];
+      else if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose"))
+         verbose = true;
+      else if (!strcmp(argv[i], "-q") || !strcmp(argv[i], "--quiet"))
+         quiet = true;
+      else if (!core_path)
+         core_path = argv[i];
+      else if (!script_path)
+         script_path = argv[i];
+      else {
+         usage(argv[0]);
+         return 2;
+      }
+   }
+
+   if (!core_path || !script_path) {
+      usage(argv[0]);
+      return 2;
+   }
+
+   if (!load_script(script_path, &script) || !load_core(core_path, &core))
+      return 2;
+
+#ifndef HAVE_ALLOC_HOOKS
+   if (check_alloc) {
+      fprintf(stderr, "--check-alloc needs glibc, ignoring it\n");
+      check_alloc = false;
+   }
+#endif
+
+   if (frames_override >= 0)
+      script.frames = (unsigned)frames_override;
+   accept_xrgb8888 = script.accept_xrgb8888;
+   accept_rgb565 = script.accept_rgb565;
+   if (script.system_dir[0] && !system_dir_given)
+      system_dir = script.system_dir;
+
+   core.set_environment(environment);
+   core.set_video_refresh(video_refresh);
+   core.set_audio_sample(audio_sample);
+   core.set_audio_sample_batch(audio_sample_batch);
+   core.set_input_poll(input_poll);
+   core.set_input_state(input_state);
+   core.init();
+
+   for (unsigned i = 0; i < script.num_option_events; i++) {
+      if (script.option_events[i].at_load && !set_option(script_path, &script.option_events[i]))
+         return 1;
+   }
+
+   struct retro_game_info game = { "", NULL, 0, NULL };
+   if (!core.load_game(&game)) {
+      fprintf(stderr, "%s: retro_load_game failed\n", core_path);
+      return 1;
+   }
+
+   struct retro_system_av_info av_info;
+   core.get_system_av_info(&av_info);
+   if (capture_prefix && !capture_open(capture_prefix, script.audio_delay))
+      return 1;
+
+   for (current_frame = 0; current_frame < script.frames; current_frame++) {
+      for (unsigned i = 0; i < script.num_events; i++) {
+         if (script.events[i].frame == current_frame)
+            port_buttons[script.events[i].port] = script.events[i].buttons;
+      }
+
+      for (unsigned i = 0; i < script.num_option_events; i++) {
+         const struct option_event *ev = &script.option_events[i];
+
+         if (!ev->at_load && ev->frame == current_frame && !set_option(script_path, ev))
+            return 1;
+      }
+
+      if (have_frame_time) {
+         frame_time.callback(frame_time.reference);
+         frame_time_calls++;
+      }
+
+      capture_copies = 1;
+      for (unsigned i = 0; i < script.num_capture_events; i++) {
+         if (script.capture_events[i].frame == current_frame)
+            capture_copies = script.capture_events[i].copies;
+      }
+
+      kept_frame = NULL;
+      in_core_run = check_alloc;
+      in_run = true;
+      core.run();
+      in_run = false;
+      in_core_run = false;
+
+      if (kept_frame && hash_frame(kept_frame, last_width, last_height, kept_pitch) != kept_hash) {
+         if (!changed_frames)
+            first_changed_frame = current_frame;
+         changed_frames++;
+      }
+   }
+
+   bool stats_ok = check_stats(&core, script_path, script.frames);
+   if (capture_prefix)
+      stats_ok = capture_close(capture_prefix, (unsigned)(av_info.timing.sample_rate + 0.5)) && stats_ok;
+
+   core.unload_game();
+   core.deinit();
+   dlclose(core.handle);
+
+   printf("%s: %u frames (%llu video, %llu dupes, last %ux%u), %llu audio frames\n",
+          script_path, script.frames,
+          (unsigned long long)video_frames, (unsigned long long)video_dupes,
+          last_width, last_height, (unsigned long long)audio_frames);
+   printf("expect video %016llx\n", (unsigned long long)video_hash);
+   printf("expect audio %016llx\n", (unsigned long long)audio_hash);
+   printf("expect av_info %u\n", av_info_calls);
+   printf("expect geometry %u\n", geometry_calls);
+
+   bool ok = stats_ok;
+   if (check_alloc && (run_allocs || run_frees)) {
+      fprintf(stderr, "%s: core made %llu allocations and %llu frees in retro_run(), first in frame %ld\n",
+              script_path, (unsigned long long)run_allocs,
+              (unsigned long long)run_frees, first_alloc_frame);
+      ok = false;
+   }
+   if (changed_frames) {
+      fprintf(stderr, "%s: core changed %u frames after handing them over, first in frame %ld\n",
+              script_path, changed_frames, first_changed_frame);
+      ok = false;
+   }
+   if (run_pixel_formats) {
+      fprintf(stderr, "%s: core called SET_PIXEL_FORMAT %u times in retro_run()\n",
+              script_path, run_pixel_formats);
+      ok = false;
+   }
+   if (script.has_video_hash && script.video_hash != video_hash) {
+      fprintf(stderr, "%s: video hash mismatch (expected %016llx)\n",
+              script_path, (unsigned long long)script.video_hash);
+      ok = false;
+   }
+   if (script.has_audio_hash && script.audio_hash != audio_hash) {
+      fprintf(stderr, "%s: audio hash mismatch (expected %016llx)\n",
+              script_path, (unsigned long long)script.audio_hash);
+      ok = false;
+   }
+   if (script.has_av_info_calls && script.av_info_calls != av_info_calls) {
+      fprintf(stderr, "%s: %u SET_SYSTEM_AV_INFO calls (expected %u)\n",
+              script_path, av_info_calls, script.av_info_calls);
+      ok = false;
+   }
+   if (script.has_geometry_calls && script.geometry_calls != geometry_calls) {
+      fprintf(stderr, "%s: %u SET_GEOMETRY calls (expected %u)\n",
+              script_path, geometry_calls, script.geometry_calls);
+      ok = false;
+   }
+
+   return ok ? 0 : 1;
+}
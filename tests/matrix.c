@@ -0,0 +1,565 @@
+/* Parallel configuration matrix for the core.
+ *
+ * Runs every combination of refresh rate, resolution, pixel format,
+ * audio source and audio pause pattern as its own core instance
+ * (avtest.h), sharded over a pool of threads. Each run hashes every
+ * video frame and audio sample like tests/headless.c does, and has to
+ * leave the statistics block (stats.h) in agreement with what was sent.
+ *
+ * The frontend callbacks carry no instance, so every worker thread keeps
+ * the run it is driving in a thread-local pointer.
+ *
+ * The output is one line per configuration, in matrix order whatever
+ * the thread count, and is itself a valid expect file:
+ *
+ *   frames <count>
+ *   <configuration> <video hash> <audio hash>   # <ms>
+ *
+ * Given such a file with -e, the frame count comes from it and any
+ * configuration whose hashes differ fails the run. Samples are hashed a
+ * word at a time, so the hashes do not match those of tests/headless.c.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../avtest.h"
+#include "../stats.h"
+
+#define MAX_OPTIONS 32
+#define OPTION_TEXT 256
+#define NAME_SIZE 64
+#define FNV_OFFSET 1469598103934665603ULL
+#define FNV_PRIME 1099511628211ULL
+/* Every instance holds about 25 MB of frame buffers, sized for 1080p */
+#define MAX_DEFAULT_JOBS 16
+#define PAUSE_TOGGLE_FRAMES 90
+
+static const char *const refresh_rates[] = { "60", "50" };
+static const char *const resolutions[] = { "auto", "320x240", "320x288", "640x480", "1280x720", "1920x1080" };
+static const char *const pixel_formats[] = { "xrgb8888", "rgb565" };
+static const char *const audio_sources[] = { "alternate", "both", "left", "right", "mix" };
+
+/* When START, which pauses and resumes the audio, is pressed */
+enum pause_pattern {
+   PAUSE_NONE = 0,  /* never */
+   PAUSE_ONCE,      /* paused for the middle third of the run */
+   PAUSE_TOGGLE,    /* every PAUSE_TOGGLE_FRAMES frames */
+   PAUSE_COUNT
+};
+
+static const char *const pause_names[PAUSE_COUNT] = { "none", "once", "toggle" };
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+#define NUM_JOBS (COUNT(refresh_rates) * COUNT(resolutions) * COUNT(pixel_formats) * \
+                  COUNT(audio_sources) * PAUSE_COUNT)
+
+struct option {
+   char key[OPTION_TEXT];
+   char value[OPTION_TEXT];
+};
+
+/* One configuration and everything its frontend keeps */
+struct job {
+   char name[NAME_SIZE];
+   const char *refresh;
+   const char *resolution;
+   const char *pixel_format_name;
+   const char *audio_source;
+   enum pause_pattern pause;
+
+   struct option options[MAX_OPTIONS];
+   unsigned num_options;
+   enum retro_pixel_format pixel_format;
+   const struct avtest_stats *mapped_stats;
+   unsigned frame;
+   uint16_t buttons;
+
+   uint64_t video_hash;
+   uint64_t audio_hash;
+   uint64_t video_frames;
+   uint64_t audio_frames;
+   double ms;
+   bool ok;
+
+   bool has_expected;
+   uint64_t expected_video;
+   uint64_t expected_audio;
+};
+
+static struct job jobs[NUM_JOBS];
+static unsigned frames = 1200;
+static const char *system_dir = ".";
+static bool verbose = false;
+
+static pthread_mutex_t next_job_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned next_job = 0;
+
+static __thread struct job *job;
+
+static double now_ms(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+   const uint8_t *bytes = data;
+
+   for (size_t i = 0; i < size; i++) {
+      hash ^= bytes[i];
+      hash *= FNV_PRIME;
+   }
+   return hash;
+}
+
+/* FNV-1a over 64-bit words in four interleaved lanes, which are then
+ * folded into hash; the tail is done bytewise */
+static uint64_t fnv1a_words(uint64_t hash, const void *data, size_t size)
+{
+   const uint8_t *bytes = data;
+   uint64_t lanes[4] = { hash, hash ^ 1, hash ^ 2, hash ^ 3 };
+   size_t i = 0;
+
+   for (; i + 32 <= size; i += 32) {
+      uint64_t words[4];
+      memcpy(words, bytes + i, sizeof(words));
+      for (unsigned l = 0; l < 4; l++)
+         lanes[l] = (lanes[l] ^ words[l]) * FNV_PRIME;
+   }
+   hash = fnv1a(hash, lanes, sizeof(lanes));
+   return fnv1a(hash, bytes + i, size - i);
+}
+
+static void log_printf(enum retro_log_level level, const char *fmt, ...)
+{
+   char text[512];
+   va_list args;
+
+   if (!verbose && level < RETRO_LOG_WARN)
+      return;
+
+   va_start(args, fmt);
+   vsnprintf(text, sizeof(text), fmt, args);
+   va_end(args);
+   fprintf(stderr, "%s: %s", job->name, text);
+}
+
+static struct option *find_option(const char *key)
+{
+   for (unsigned i = 0; i < job->num_options; i++) {
+      if (strcmp(job->options[i].key, key) == 0)
+         return &job->options[i];
+   }
+   return NULL;
+}
+
+static void set_option(const char *key, const char *value)
+{
+   struct option *opt = find_option(key);
+
+   if (opt)
+      snprintf(opt->value, sizeof(opt->value), "%s", value);
+   else
+      fprintf(stderr, "%s: core has no option %s\n", job->name, key);
+}
+
+/* Declares the core's options with the job's configuration in place of
+ * the defaults, so that it is in effect from retro_load_game() on */
+static void declare_options(const struct retro_core_options_v2 *opts)
+{
+   job->num_options = 0;
+   for (const struct retro_core_option_v2_definition *def = opts->definitions;
+        def->key && job->num_options < MAX_OPTIONS; def++) {
+      struct option *opt = &job->options[job->num_options++];
+      snprintf(opt->key, sizeof(opt->key), "%s", def->key);
+      snprintf(opt->value, sizeof(opt->value), "%s",
+               def->default_value ? def->default_value : def->values[0].value);
+   }
+
+   set_option("avtest_refresh", job->refresh);
+   set_option("avtest_resolution", job->resolution);
+   set_option("avtest_pixel_format", job->pixel_format_name);
+   set_option("avtest_audio_source", job->audio_source);
+}
+
+static bool environment(unsigned cmd, void *data)
+{
+   switch (cmd) {
+      case RETRO_ENVIRONMENT_GET_LOG_INTERFACE:
+         ((struct retro_log_callback *)data)->log = log_printf;
+         return true;
+      case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
+         job->pixel_format = *(const enum retro_pixel_format *)data;
+         return job->pixel_format == RETRO_PIXEL_FORMAT_XRGB8888 ||
+                job->pixel_format == RETRO_PIXEL_FORMAT_RGB565;
+      case RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY:
+         *(const char **)data = system_dir;
+         return true;
+      case RETRO_ENVIRONMENT_GET_INPUT_BITMASKS:
+         return true;
+      case RETRO_ENVIRONMENT_GET_CORE_OPTIONS_VERSION:
+         *(unsigned *)data = 2;
+         return true;
+      case RETRO_ENVIRONMENT_SET_CORE_OPTIONS_V2:
+         declare_options(data);
+         return true;
+      case RETRO_ENVIRONMENT_GET_VARIABLE: {
+         struct retro_variable *var = data;
+         struct option *opt = find_option(var->key);
+         var->value = opt ? opt->value : NULL;
+         return opt != NULL;
+      }
+      case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE:
+         *(bool *)data = false;
+         return true;
+      case RETRO_ENVIRONMENT_SET_MEMORY_MAPS: {
+         const struct retro_memory_map *map = data;
+         job->mapped_stats = NULL;
+         for (unsigned i = 0; i < map->num_descriptors; i++) {
+            const struct retro_memory_descriptor *desc = &map->descriptors[i];
+            if ((desc->flags & RETRO_MEMDESC_SYSTEM_RAM) && desc->len >= sizeof(*job->mapped_stats))
+               job->mapped_stats = (const struct avtest_stats *)((const uint8_t *)desc->ptr + desc->offset);
+         }
+         return true;
+      }
+      case RETRO_ENVIRONMENT_SET_GEOMETRY:
+      case RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO:
+      case RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS:
+      case RETRO_ENVIRONMENT_SET_CONTROLLER_INFO:
+      case RETRO_ENVIRONMENT_SET_FASTFORWARDING_OVERRIDE:
+         return true;
+      default:
+         return false;
+   }
+}
+
+static void video_refresh(const void *data, unsigned width, unsigned height, size_t pitch)
+{
+   if (!data) {
+      job->video_hash = fnv1a(job->video_hash, "dupe", 4);
+      return;
+   }
+
+   size_t bpp = job->pixel_format == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2;
+   uint64_t frame_hash = FNV_OFFSET;
+
+   frame_hash = fnv1a(frame_hash, &width, sizeof(width));
+   frame_hash = fnv1a(frame_hash, &height, sizeof(height));
+   for (unsigned y = 0; y < height; y++)
+      frame_hash = fnv1a_words(frame_hash, (const uint8_t *)data + y * pitch, width * bpp);
+
+   job->video_hash = fnv1a(job->video_hash, &frame_hash, sizeof(frame_hash));
+   job->video_frames++;
+}
+
+static size_t audio_sample_batch(const int16_t *data, size_t count)
+{
+   job->audio_hash = fnv1a_words(job->audio_hash, data, count * 2 * sizeof(int16_t));
+   job->audio_frames += count;
+   return count;
+}
+
+static void audio_sample(int16_t left, int16_t right)
+{
+   int16_t frame[2] = { left, right };
+   audio_sample_batch(frame, 1);
+}
+
+static void input_poll(void)
+{
+}
+
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+   if (port != 0 || device != RETRO_DEVICE_JOYPAD || index != 0)
+      return 0;
+
+   if (id == RETRO_DEVICE_ID_JOYPAD_MASK)
+      return (int16_t)job->buttons;
+
+   return id < 16 ? (job->buttons >> id) & 1 : 0;
+}
+
+static bool start_pressed(const struct job *j, unsigned frame)
+{
+   switch (j->pause) {
+      case PAUSE_ONCE:
+         return frame == frames / 3 || frame == frames * 2 / 3;
+      case PAUSE_TOGGLE:
+         return frame % PAUSE_TOGGLE_FRAMES == PAUSE_TOGGLE_FRAMES - 1;
+      default:
+         return false;
+   }
+}
+
+/* Compares the core's statistics block with what this run counted */
+static bool check_stats(struct avtest *ctx)
+{
+   const struct avtest_stats *stats = avtest_get_memory_data(ctx, RETRO_MEMORY_SYSTEM_RAM);
+   uint64_t timed = 0;
+
+   if (!stats || stats != job->mapped_stats || stats->magic != STATS_MAGIC) {
+      fprintf(stderr, "%s: no statistics block in the memory map\n", job->name);
+      return false;
+   }
+
+   for (unsigned i = 0; i < STATS_FRAME_TIME_BUCKETS; i++)
+      timed += stats->frame_time_hist[i];
+
+   if (stats->frames != frames || stats->audio_frames != job->audio_frames ||
+       timed != frames || stats->audio_short_writes != 0) {
+      fprintf(stderr, "%s: statistics say %llu frames, %llu audio frames, %llu frame times, "
+              "%u short writes (expected %u, %llu, %u, 0)\n", job->name,
+              (unsigned long long)stats->frames, (unsigned long long)stats->audio_frames,
+              (unsigned long long)timed, stats->audio_short_writes, frames,
+              (unsigned long long)job->audio_frames, frames);
+      return false;
+   }
+
+   return true;
+}
+
+static bool run_job(void)
+{
+   struct avtest *ctx = avtest_create();
+   struct retro_game_info game = { "", NULL, 0, NULL };
+   struct retro_system_av_info av;
+   bool ok;
+
+   if (!ctx) {
+      fprintf(stderr, "%s: out of memory\n", job->name);
+      return false;
+   }
+
+   job->video_hash = FNV_OFFSET;
+   job->audio_hash = FNV_OFFSET;
+
+   avtest_set_environment(ctx, environment);
+   avtest_set_video_refresh(ctx, video_refresh);
+   avtest_set_audio_sample(ctx, audio_sample);
+   avtest_set_audio_sample_batch(ctx, audio_sample_batch);
+   avtest_set_input_poll(ctx, input_poll);
+   avtest_set_input_state(ctx, input_state);
+   avtest_init(ctx);
+
+   ok = avtest_load_game(ctx, &game);
+   if (!ok) {
+      fprintf(stderr, "%s: retro_load_game failed\n", job->name);
+   } else {
+      avtest_get_system_av_info(ctx, &av);
+      const retro_usec_t frame_usec = (retro_usec_t)(1000000.0 / av.timing.fps);
+
+      for (job->frame = 0; job->frame < frames; job->frame++) {
+         job->buttons = start_pressed(job, job->frame) ? 1 << RETRO_DEVICE_ID_JOYPAD_START : 0;
+         avtest_frame_time(ctx, frame_usec);
+         avtest_run(ctx);
+      }
+
+      ok = check_stats(ctx);
+      avtest_unload_game(ctx);
+   }
+
+   avtest_deinit(ctx);
+   avtest_destroy(ctx);
+   return ok;
+}
+
+static void *worker(void *arg)
+{
+   (void)arg;
+
+   for (;;) {
+      pthread_mutex_lock(&next_job_lock);
+      unsigned index = next_job < NUM_JOBS ? next_job++ : NUM_JOBS;
+      pthread_mutex_unlock(&next_job_lock);
+      if (index == NUM_JOBS)
+         return NULL;
+
+      job = &jobs[index];
+      double start = now_ms();
+      job->ok = run_job();
+      job->ms = now_ms() - start;
+   }
+}
+
+static void build_jobs(void)
+{
+   struct job *j = jobs;
+
+   for (size_t r = 0; r < COUNT(refresh_rates); r++)
+      for (size_t s = 0; s < COUNT(resolutions); s++)
+         for (size_t f = 0; f < COUNT(pixel_formats); f++)
+            for (size_t a = 0; a < COUNT(audio_sources); a++)
+               for (unsigned p = 0; p < PAUSE_COUNT; p++, j++) {
+                  j->refresh = refresh_rates[r];
+                  j->resolution = resolutions[s];
+                  j->pixel_format_name = pixel_formats[f];
+                  j->audio_source = audio_sources[a];
+                  j->pause = (enum pause_pattern)p;
+                  snprintf(j->name, sizeof(j->name), "%shz-%s-%s-%s-%s", j->refresh,
+                           j->resolution, j->pixel_format_name, j->audio_source,
+                           pause_names[p]);
+               }
+}
+
+static struct job *find_job(const char *name)
+{
+   for (unsigned i = 0; i < NUM_JOBS; i++) {
+      if (strcmp(jobs[i].name, name) == 0)
+         return &jobs[i];
+   }
+   return NULL;
+}
+
+static bool load_expected(const char *path)
+{
+   FILE *fp = fopen(path, "r");
+   char line[512];
+   unsigned line_no = 0;
+
+   if (!fp) {
+      fprintf(stderr, "%s: %s\n", path, strerror(errno));
+      return false;
+   }
+
+   while (fgets(line, sizeof(line), fp)) {
+      char word[NAME_SIZE], arg1[64], arg2[64];
+      char *comment = strchr(line, '#');
+      struct job *j;
+      int n;
+
+      line_no++;
+      if (comment)
+         *comment = '\0';
+
+      n = sscanf(line, "%63s %63s %63s", word, arg1, arg2);
+      if (n <= 0)
+         continue;
+
+      if (strcmp(word, "frames") == 0 && n == 2) {
+         frames = (unsigned)strtoul(arg1, NULL, 0);
+      } else if (n == 3 && (j = find_job(word))) {
+         j->expected_video = strtoull(arg1, NULL, 16);
+         j->expected_audio = strtoull(arg2, NULL, 16);
+         j->has_expected = true;
+      } else {
+         fprintf(stderr, "%s:%u: invalid statement\n", path, line_no);
+         fclose(fp);
+         return false;
+      }
+   }
+
+   fclose(fp);
+   return true;
+}
+
+static void usage(const char *prog)
+{
+   fprintf(stderr,
+           "Usage: %s [options]\n"
+           "  -e, --expect FILE  check the hashes (and take the frame count) from FILE\n"
+           "  -f, --frames N     frames per configuration (default %u)\n"
+           "  -j, --jobs N       worker threads, about 25 MB each (default: one per\n"
+           "                     CPU, at most %d)\n"
+           "  -s, --system DIR   system directory reported to the core\n"
+           "  -v, --verbose      show the core's info messages\n",
+           prog, frames, MAX_DEFAULT_JOBS);
+}
+
+int main(int argc, char **argv)
+{
+   const char *expect_path = NULL;
+   long frames_override = -1;
+   long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+   if (threads > MAX_DEFAULT_JOBS)
+      threads = MAX_DEFAULT_JOBS;
+
+   for (int i = 1; i < argc; i++) {
+      if ((!strcmp(argv[i], "-e") || !strcmp(argv[i], "--expect")) && i + 1 < argc)
+         expect_path = argv[++i];
+      else if ((!strcmp(argv[i], "-f") || !strcmp(argv[i], "--frames")) && i + 1 < argc)
+         frames_override = strtol(argv[++i], NULL, 0);
+      else if ((!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) && i + 1 < argc)
+         threads = strtol(argv[++i], NULL, 0);
+      else if ((!strcmp(argv[i], "-s") || !strcmp(argv[i], "--system")) && i + 1 < argc)
+         system_dir = argv[++i];
+      else if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose"))
+         verbose = true;
+      else {
+         usage(argv[0]);
+         return 2;
+      }
+   }
+
+   build_jobs();
+   if (expect_path && !load_expected(expect_path))
+      return 2;
+   if (frames_override >= 0)
+      frames = (unsigned)frames_override;
+   if (threads < 1)
+      threads = 1;
+   if (threads > (long)NUM_JOBS)
+      threads = NUM_JOBS;
+
+   pthread_t *pool = calloc((size_t)threads, sizeof(*pool));
+   double start = now_ms();
+   long started = 0;
+
+   if (!pool) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+
+   /* The calling thread works too, so a failed pthread_create only
+    * costs parallelism */
+   while (started < threads - 1 && pthread_create(&pool[started], NULL, worker, NULL) == 0)
+      started++;
+   worker(NULL);
+   for (long i = 0; i < started; i++)
+      pthread_join(pool[i], NULL);
+   free(pool);
+
+   double elapsed = now_ms() - start;
+   double slowest = 0.0;
+   unsigned failed = 0;
+
+   printf("frames %u\n", frames);
+   for (unsigned i = 0; i < NUM_JOBS; i++) {
+      struct job *j = &jobs[i];
+
+      printf("%-40s %016llx %016llx   # %.1f ms\n", j->name,
+             (unsigned long long)j->video_hash, (unsigned long long)j->audio_hash, j->ms);
+
+      if (j->ok && j->has_expected &&
+          (j->video_hash != j->expected_video || j->audio_hash != j->expected_audio)) {
+         fprintf(stderr, "%s: hash mismatch (expected %016llx %016llx)\n", j->name,
+                 (unsigned long long)j->expected_video, (unsigned long long)j->expected_audio);
+         j->ok = false;
+      } else if (j->ok && expect_path && !j->has_expected) {
+         fprintf(stderr, "%s: not in %s\n", j->name, expect_path);
+         j->ok = false;
+      }
+
+      failed += !j->ok;
+      if (j->ms > slowest)
+         slowest = j->ms;
+   }
+
+   fprintf(stderr, "%u configurations x %u frames on %ld threads in %.0f ms "
+           "(%.0f frames/s, slowest %.0f ms), %u failed\n",
+           (unsigned)NUM_JOBS, frames, started + 1, elapsed,
+           NUM_JOBS * (double)frames * 1000.0 / elapsed, slowest, failed);
+
+   return failed ? 1 : 0;
+}
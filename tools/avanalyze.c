@@ -0,0 +1,584 @@
+/* Decodes the frame markers (see markers.h) in a capture of the core's
+ * output, made with the avtest_markers option on, and reports dropped and
+ * repeated core frames, how many capture frames each core frame stayed
+ * on screen, and the audio offset of every core frame whose audio batch
+ * carries a marker.
+ *
+ * The video is a raw dump of fixed-size frames with no padding between
+ * rows (e.g. ffmpeg -f rawvideo), the audio a 16-bit stereo PCM WAV; both
+ * recordings are taken to start at the same moment. The files are mapped
+ * and cut into one chunk per thread, so multi-gigabyte captures are only
+ * read once, at disk speed. Scaled captures work as long as the scale is
+ * an integer: pass the scaled marker cell size with -c.
+ *
+ * Usage: avanalyze [options] <video.raw> [audio.wav]
+ *   -s WxH      capture size (default 320x240)
+ *   -p FORMAT   bgr0 (XRGB8888 in memory), rgb565 or rgb24 (default bgr0)
+ *   -r FPS      capture frame rate (default 60)
+ *   -c N        marker cell size in capture pixels (default 8)
+ *   -j N        threads (default: one per core)
+ *   -v          list every core frame
+ */
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../markers.h"
+
+#define MAX_THREADS 256
+#define HIST_BUCKETS 8
+#define HIST_WIDTH 50
+/* Audio samples may be this far off the marker level, for frontends that
+ * dither or resample by a hair */
+#define LEVEL_TOLERANCE 8
+
+enum format {
+   FORMAT_BGR0,
+   FORMAT_RGB565,
+   FORMAT_RGB24
+};
+
+struct mapping {
+   const uint8_t *data;
+   size_t size;
+};
+
+struct capture {
+   const uint8_t *video;
+   size_t frame_bytes;
+   size_t frames;
+   unsigned width;
+   unsigned height;
+   unsigned cell;
+   enum format format;
+   unsigned bpp;
+   const uint8_t *audio;   /* interleaved stereo, little endian */
+   size_t audio_frames;
+   unsigned audio_rate;
+};
+
+struct audio_marker {
+   size_t pos;
+   uint16_t code;
+};
+
+/* One thread's share of the capture */
+struct chunk {
+   const struct capture *cap;
+   size_t begin;
+   size_t end;
+   int64_t *codes;               /* video: one per capture frame */
+   struct audio_marker *markers; /* audio: found in [begin, end) */
+   size_t num_markers;
+   size_t max_markers;
+   bool failed;
+};
+
+/* A core frame and the capture frames that showed it */
+struct run {
+   int64_t code;
+   size_t first;
+   size_t count;
+};
+
+static bool map_file(const char *path, struct mapping *map)
+{
+   struct stat st;
+   int fd = open(path, O_RDONLY);
+
+   if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+      fprintf(stderr, "%s: cannot read\n", path);
+      if (fd >= 0)
+         close(fd);
+      return false;
+   }
+
+   map->size = (size_t)st.st_size;
+   map->data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (map->data == MAP_FAILED) {
+      fprintf(stderr, "%s: cannot map\n", path);
+      return false;
+   }
+
+   madvise((void *)map->data, map->size, MADV_SEQUENTIAL);
+   return true;
+}
+
+static uint32_t read_le32(const uint8_t *p)
+{
+   return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static unsigned read_le16(const uint8_t *p)
+{
+   return p[0] | p[1] << 8;
+}
+
+/* Finds the 16-bit stereo PCM data in a WAV file */
+static bool parse_wav(const char *path, const struct mapping *map, struct capture *cap)
+{
+   size_t pos = 12;
+   bool have_fmt = false;
+
+   if (map->size < 12 || memcmp(map->data, "RIFF", 4) || memcmp(map->data + 8, "WAVE", 4)) {
+      fprintf(stderr, "%s: not a WAV file\n", path);
+      return false;
+   }
+
+   while (pos + 8 <= map->size) {
+      const uint8_t *chunk = map->data + pos;
+      size_t size = read_le32(chunk + 4);
+      size_t avail = map->size - pos - 8;
+
+      if (!memcmp(chunk, "fmt ", 4) && size >= 16 && avail >= 16) {
+         if (read_le16(chunk + 8) != 1 || read_le16(chunk + 10) != 2 ||
+             read_le16(chunk + 22) != 16) {
+            fprintf(stderr, "%s: not 16-bit stereo PCM\n", path);
+            return false;
+         }
+         cap->audio_rate = read_le32(chunk + 12);
+         have_fmt = true;
+      } else if (!memcmp(chunk, "data", 4) && have_fmt) {
+         /* Recorders that were killed leave the size unpatched */
+         if (size > avail || size == 0)
+            size = avail;
+         cap->audio = chunk + 8;
+         cap->audio_frames = size / 4;
+         return cap->audio_rate != 0;
+      }
+
+      pos += 8 + size + (size & 1);
+   }
+
+   fprintf(stderr, "%s: no audio data\n", path);
+   return false;
+}
+
+static bool is_white(const struct capture *cap, const uint8_t *p)
+{
+   unsigned r, g, b;
+
+   switch (cap->format) {
+      case FORMAT_BGR0:
+         b = p[0];
+         g = p[1];
+         r = p[2];
+         break;
+      case FORMAT_RGB565: {
+         unsigned v = read_le16(p);
+         r = (v >> 11) << 3;
+         g = ((v >> 5) & 0x3F) << 2;
+         b = (v & 0x1F) << 3;
+         break;
+      }
+      default:
+         r = p[0];
+         g = p[1];
+         b = p[2];
+         break;
+   }
+
+   return r + 2 * g + b >= 4 * 128;
+}
+
+/* Reads the barcode through the middle of its cells; -1 if there is none */
+static int64_t decode_frame(const struct capture *cap, const uint8_t *frame)
+{
+   const uint8_t *row = frame + (size_t)(cap->height - cap->cell + cap->cell / 2) *
+                                cap->width * cap->bpp;
+   uint32_t code = 0;
+   unsigned parity = 0;
+
+   for (unsigned i = 0; i < MARKER_CELLS; i++) {
+      unsigned bit = is_white(cap, row + (size_t)(i * cap->cell + cap->cell / 2) * cap->bpp);
+
+      if (i == 0) {
+         if (!bit)
+            return -1;
+      } else if (i <= MARKER_BITS) {
+         code = code << 1 | bit;
+         parity ^= bit;
+      } else if (bit != parity) {
+         return -1;
+      }
+   }
+
+   return code;
+}
+
+static void *decode_video(void *arg)
+{
+   struct chunk *c = arg;
+   const struct capture *cap = c->cap;
+
+   for (size_t i = c->begin; i < c->end; i++)
+      c->codes[i] = decode_frame(cap, cap->video + i * cap->frame_bytes);
+
+   return NULL;
+}
+
+/* The data chunk may start at any offset in the file */
+static int read_sample(const struct capture *cap, size_t pos, unsigned channel)
+{
+   return (int16_t)read_le16(cap->audio + (pos * 2 + channel) * 2);
+}
+
+static bool near_level(int sample, int level)
+{
+   return abs(sample - level) <= LEVEL_TOLERANCE;
+}
+
+/* Reads the marker starting at pos, if there is one */
+static bool decode_marker(const struct capture *cap, size_t pos, uint16_t *code)
+{
+   unsigned value = 0;
+
+   if (!near_level(read_sample(cap, pos, 0), MARKER_LEVEL) || pos + MARKER_AUDIO_FRAMES > cap->audio_frames)
+      return false;
+
+   for (unsigned i = 0; i < MARKER_AUDIO_FRAMES; i++) {
+      int left = read_sample(cap, pos + i, 0);
+      int right = read_sample(cap, pos + i, 1);
+      bool high = near_level(left, MARKER_LEVEL);
+
+      if (!high && !near_level(left, -MARKER_LEVEL))
+         return false;
+      if (!near_level(right, -left))
+         return false;
+      if (i < MARKER_AUDIO_SYNC) {
+         if (high != ((i & 1) == 0))
+            return false;
+      } else {
+         value = value << 1 | high;
+      }
+   }
+
+   *code = (uint16_t)value;
+   return true;
+}
+
+static void *scan_audio(void *arg)
+{
+   struct chunk *c = arg;
+   uint16_t code;
+
+   for (size_t pos = c->begin; pos < c->end; pos++) {
+      if (!decode_marker(c->cap, pos, &code))
+         continue;
+
+      if (c->num_markers == c->max_markers) {
+         size_t max = c->max_markers ? c->max_markers * 2 : 1024;
+         struct audio_marker *markers = realloc(c->markers, max * sizeof(*markers));
+         if (!markers) {
+            c->failed = true;
+            return NULL;
+         }
+         c->markers = markers;
+         c->max_markers = max;
+      }
+
+      c->markers[c->num_markers].pos = pos;
+      c->markers[c->num_markers].code = code;
+      c->num_markers++;
+      pos += MARKER_AUDIO_FRAMES - 1;
+   }
+
+   return NULL;
+}
+
+/* Splits [0, total) in one chunk per thread and runs fn on all of them */
+static bool run_chunks(struct chunk *chunks, unsigned threads, size_t total,
+                       void *(*fn)(void *))
+{
+   pthread_t ids[MAX_THREADS];
+   bool ok = true;
+
+   for (unsigned t = 0; t < threads; t++) {
+      chunks[t].begin = total * t / threads;
+      chunks[t].end = total * (t + 1) / threads;
+      if (pthread_create(&ids[t], NULL, fn, &chunks[t]) != 0) {
+         fprintf(stderr, "cannot start thread\n");
+         threads = t;
+         ok = false;
+         break;
+      }
+   }
+
+   for (unsigned t = 0; t < threads; t++) {
+      pthread_join(ids[t], NULL);
+      ok = ok && !chunks[t].failed;
+   }
+
+   return ok;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+   double x = *(const double *)a;
+   double y = *(const double *)b;
+   return (x > y) - (x < y);
+}
+
+static double median(double *values, size_t count)
+{
+   qsort(values, count, sizeof(*values), compare_double);
+   return values[count / 2];
+}
+
+static void usage(const char *prog)
+{
+   fprintf(stderr,
+           "Usage: %s [options] <video.raw> [audio.wav]\n"
+           "  -s WxH      capture size (default 320x240)\n"
+           "  -p FORMAT   bgr0, rgb565 or rgb24 (default bgr0)\n"
+           "  -r FPS      capture frame rate (default 60)\n"
+           "  -c N        marker cell size in capture pixels (default %u)\n"
+           "  -j N        threads (default: one per core)\n"
+           "  -v          list every core frame\n",
+           prog, MARKER_CELL);
+}
+
+int main(int argc, char **argv)
+{
+   struct capture cap = { 0 };
+   struct mapping video_map, audio_map;
+   const char *video_path = NULL;
+   const char *audio_path = NULL;
+   double fps = 60.0;
+   long threads = sysconf(_SC_NPROCESSORS_ONLN);
+   bool verbose = false;
+   static struct chunk chunks[MAX_THREADS];
+
+   cap.width = 320;
+   cap.height = 240;
+   cap.cell = MARKER_CELL;
+   cap.format = FORMAT_BGR0;
+
+   for (int i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+         if (sscanf(argv[++i], "%ux%u", &cap.width, &cap.height) != 2)
+            goto bad_usage;
+      } else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+         const char *name = argv[++i];
+         if (!strcmp(name, "bgr0"))
+            cap.format = FORMAT_BGR0;
+         else if (!strcmp(name, "rgb565"))
+            cap.format = FORMAT_RGB565;
+         else if (!strcmp(name, "rgb24"))
+            cap.format = FORMAT_RGB24;
+         else
+            goto bad_usage;
+      } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+         fps = strtod(argv[++i], NULL);
+      } else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+         cap.cell = (unsigned)strtoul(argv[++i], NULL, 0);
+      } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+         threads = strtol(argv[++i], NULL, 0);
+      } else if (!strcmp(argv[i], "-v")) {
+         verbose = true;
+      } else if (!video_path) {
+         video_path = argv[i];
+      } else if (!audio_path) {
+         audio_path = argv[i];
+      } else {
+         goto bad_usage;
+      }
+   }
+
+   if (!video_path || fps <= 0.0 || cap.cell == 0 ||
+       cap.width < MARKER_CELLS * cap.cell || cap.height < cap.cell)
+      goto bad_usage;
+   if (threads < 1)
+      threads = 1;
+   if (threads > MAX_THREADS)
+      threads = MAX_THREADS;
+
+   cap.bpp = cap.format == FORMAT_BGR0 ? 4 : cap.format == FORMAT_RGB565 ? 2 : 3;
+   cap.frame_bytes = (size_t)cap.width * cap.height * cap.bpp;
+
+   if (!map_file(video_path, &video_map))
+      return 1;
+   cap.video = video_map.data;
+   cap.frames = video_map.size / cap.frame_bytes;
+   if (video_map.size % cap.frame_bytes)
+      fprintf(stderr, "%s: ignoring %zu trailing bytes\n", video_path,
+              video_map.size % cap.frame_bytes);
+
+   if (audio_path && (!map_file(audio_path, &audio_map) ||
+                      !parse_wav(audio_path, &audio_map, &cap)))
+      return 1;
+
+   /* Video: the counter shown by every capture frame */
+   int64_t *codes = malloc((cap.frames ? cap.frames : 1) * sizeof(*codes));
+   struct run *runs = malloc((cap.frames ? cap.frames : 1) * sizeof(*runs));
+   if (!codes || !runs) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+
+   for (long t = 0; t < threads; t++) {
+      chunks[t].cap = &cap;
+      chunks[t].codes = codes;
+   }
+   if (!run_chunks(chunks, (unsigned)threads, cap.frames, decode_video))
+      return 1;
+
+   size_t num_runs = 0, unreadable = 0, dropped = 0, gaps = 0, repeats = 0, backwards = 0;
+   size_t hist[HIST_BUCKETS] = { 0 };
+
+   for (size_t i = 0; i < cap.frames; i++) {
+      struct run *last = num_runs ? &runs[num_runs - 1] : NULL;
+
+      if (codes[i] < 0) {
+         unreadable++;
+      } else if (last && codes[i] == last->code) {
+         last->count++;
+         repeats++;
+      } else {
+         if (last && codes[i] > last->code + 1) {
+            dropped += (size_t)(codes[i] - last->code - 1);
+            gaps++;
+         } else if (last && codes[i] < last->code) {
+            backwards++;
+         }
+         runs[num_runs].code = codes[i];
+         runs[num_runs].first = i;
+         runs[num_runs].count = 1;
+         num_runs++;
+      }
+   }
+
+   for (size_t r = 0; r < num_runs; r++)
+      hist[runs[r].count < HIST_BUCKETS ? runs[r].count - 1 : HIST_BUCKETS - 1]++;
+
+   printf("video: %zu capture frames, %zu unreadable\n", cap.frames, unreadable);
+   if (num_runs) {
+      printf("core frames %" PRId64 "..%" PRId64 ": %zu shown, %zu dropped in %zu gaps, "
+             "%zu repeats, %zu steps back\n",
+             runs[0].code, runs[num_runs - 1].code, num_runs, dropped, gaps,
+             repeats, backwards);
+      printf("capture frames per core frame:\n");
+
+      size_t most = 0;
+      for (unsigned b = 0; b < HIST_BUCKETS; b++)
+         most = hist[b] > most ? hist[b] : most;
+      for (unsigned b = 0; b < HIST_BUCKETS; b++) {
+         unsigned bar = (unsigned)((hist[b] * HIST_WIDTH + most - 1) / most);
+         printf("  %2u%s %10zu %.*s\n", b + 1, b == HIST_BUCKETS - 1 ? "+" : " ",
+                hist[b], bar, "##################################################");
+      }
+   }
+
+   /* Audio: markers in capture order, their 16-bit counters unwrapped
+    * from the video frame on screen at the first one */
+   struct audio_marker *markers = NULL;
+   int64_t *marker_codes = NULL;
+   size_t num_markers = 0;
+
+   if (audio_path) {
+      if (!run_chunks(chunks, (unsigned)threads, cap.audio_frames, scan_audio)) {
+         fprintf(stderr, "out of memory\n");
+         return 1;
+      }
+
+      for (long t = 0; t < threads; t++)
+         num_markers += chunks[t].num_markers;
+      markers = malloc((num_markers ? num_markers : 1) * sizeof(*markers));
+      marker_codes = malloc((num_markers ? num_markers : 1) * sizeof(*marker_codes));
+      if (!markers || !marker_codes) {
+         fprintf(stderr, "out of memory\n");
+         return 1;
+      }
+
+      /* A chunk may start inside the previous chunk's last marker */
+      num_markers = 0;
+      for (long t = 0; t < threads; t++) {
+         for (size_t m = 0; m < chunks[t].num_markers; m++) {
+            if (num_markers &&
+                chunks[t].markers[m].pos < markers[num_markers - 1].pos + MARKER_AUDIO_FRAMES)
+               continue;
+            markers[num_markers++] = chunks[t].markers[m];
+         }
+         free(chunks[t].markers);
+      }
+
+      int64_t prev = 0;
+      if (num_markers && num_runs) {
+         size_t at = (size_t)(markers[0].pos * fps / cap.audio_rate);
+         size_t r = 0;
+         while (r + 1 < num_runs && runs[r + 1].first <= at)
+            r++;
+         prev = runs[r].code;
+      }
+      for (size_t m = 0; m < num_markers; m++) {
+         prev += (int16_t)(markers[m].code - (uint16_t)prev);
+         marker_codes[m] = prev;
+      }
+
+      printf("audio: %zu frames at %u Hz, %zu markers\n", cap.audio_frames,
+             cap.audio_rate, num_markers);
+   }
+
+   /* Both lists are in counter order unless the core was reset */
+   double *offsets = malloc((num_runs ? num_runs : 1) * sizeof(*offsets));
+   size_t num_offsets = 0;
+   size_t m = 0;
+
+   if (!offsets) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+
+   for (size_t r = 0; r < num_runs; r++) {
+      const struct run *run = &runs[r];
+      bool matched = false;
+
+      while (m < num_markers && marker_codes[m] < run->code)
+         m++;
+      if (m < num_markers && marker_codes[m] == run->code) {
+         offsets[num_offsets] = (markers[m].pos / (double)cap.audio_rate -
+                                 run->first / fps) * 1000.0;
+         matched = true;
+      }
+
+      if (verbose) {
+         printf("frame %" PRId64 ": capture frame %zu, %zu frame%s", run->code,
+                run->first, run->count, run->count == 1 ? "" : "s");
+         if (matched)
+            printf(", audio %+.2f ms", offsets[num_offsets]);
+         printf("\n");
+      }
+
+      num_offsets += matched;
+   }
+
+   if (num_offsets) {
+      double lo = offsets[0], hi = offsets[0], sum = 0.0;
+      for (size_t i = 0; i < num_offsets; i++) {
+         lo = offsets[i] < lo ? offsets[i] : lo;
+         hi = offsets[i] > hi ? offsets[i] : hi;
+         sum += offsets[i];
+      }
+      printf("A/V offset over %zu frames (audio after video): min %+.2f ms, "
+             "mean %+.2f ms, median %+.2f ms, max %+.2f ms\n",
+             num_offsets, lo, sum / num_offsets, median(offsets, num_offsets), hi);
+   } else if (audio_path) {
+      printf("A/V offset: no frame has both markers\n");
+   }
+
+   return 0;
+
+bad_usage:
+   usage(argv[0]);
+   return 2;
+}
@@ -0,0 +1,48 @@
+/* Writes the built-in 8x8 font (font8x8.h) as font8x8.bin, the font asset
+ * of the asset pack: FONT8X8_NUM_GLYPHS glyphs from FONT8X8_FIRST_CHAR
+ * on, 8 bytes each, one byte per row with bit 0 the leftmost pixel.
+ *
+ * With -i every pixel is inverted, which gives the tests a font that
+ * visibly differs from the built-in one.
+ *
+ * Usage: mkfont [-i] <out.bin>
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../font8x8.h"
+
+int main(int argc, char **argv)
+{
+   const char *out_path = argv[argc - 1];
+   uint8_t invert = 0;
+   FILE *out;
+
+   if (argc == 3 && !strcmp(argv[1], "-i"))
+      invert = 0xFF;
+   else if (argc != 2) {
+      fprintf(stderr, "Usage: %s [-i] <out.bin>\n", argv[0]);
+      return 2;
+   }
+
+   out = fopen(out_path, "wb");
+   if (!out) {
+      perror(out_path);
+      return 1;
+   }
+
+   int err = 0;
+   for (unsigned g = 0; g < FONT8X8_NUM_GLYPHS && !err; g++) {
+      for (unsigned y = 0; y < 8 && !err; y++)
+         err = fputc(font8x8[g][y] ^ invert, out) == EOF;
+   }
+
+   if (fclose(out) != 0 || err) {
+      perror(out_path);
+      remove(out_path);
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,123 @@
+/* Build-time converter for the grid images.
+ *
+ * Reads packed 8-bit RGB images (as produced by the ImageMagick step in
+ * the README) and stores them as 8-bit palette indices into one palette
+ * shared by all of them. The core expands the indices to its output
+ * pixel format, so a palette change never touches the pixel data.
+ *
+ * The palette file holds a 32-bit entry count followed by the XRGB8888
+ * entries, in order of first use; all words are little-endian.
+ *
+ * Usage: mkgrid <out.pal> <in.bin> <out.idx8> [<in.bin> <out.idx8>...]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_COLORS 256
+
+static uint32_t palette[MAX_COLORS];
+static unsigned palette_size;
+
+static int write_le32(FILE *out, uint32_t value)
+{
+   for (unsigned i = 0; i < 4; i++) {
+      if (fputc((value >> (8 * i)) & 0xFF, out) == EOF)
+         return -1;
+   }
+   return 0;
+}
+
+static int lookup(uint32_t color)
+{
+   for (unsigned i = 0; i < palette_size; i++) {
+      if (palette[i] == color)
+         return (int)i;
+   }
+
+   if (palette_size == MAX_COLORS)
+      return -1;
+
+   palette[palette_size] = color;
+   return (int)palette_size++;
+}
+
+static int convert(const char *in_path, const char *out_path)
+{
+   FILE *in, *out;
+   uint8_t rgb[3];
+
+   in = fopen(in_path, "rb");
+   if (!in) {
+      perror(in_path);
+      return -1;
+   }
+
+   out = fopen(out_path, "wb");
+   if (!out) {
+      perror(out_path);
+      fclose(in);
+      return -1;
+   }
+
+   while (fread(rgb, 1, 3, in) == 3) {
+      int index = lookup(((uint32_t)rgb[0] << 16) | ((uint32_t)rgb[1] << 8) | rgb[2]);
+
+      if (index < 0) {
+         fprintf(stderr, "%s: more than %d colors\n", in_path, MAX_COLORS);
+         goto fail;
+      }
+      if (fputc(index, out) == EOF) {
+         perror(out_path);
+         goto fail;
+      }
+   }
+
+   fclose(in);
+   if (fclose(out) != 0) {
+      perror(out_path);
+      remove(out_path);
+      return -1;
+   }
+   return 0;
+
+fail:
+   fclose(in);
+   fclose(out);
+   remove(out_path);
+   return -1;
+}
+
+int main(int argc, char **argv)
+{
+   FILE *out;
+
+   if (argc < 4 || argc % 2 != 0) {
+      fprintf(stderr, "Usage: %s <out.pal> <in.bin> <out.idx8> [<in.bin> <out.idx8>...]\n", argv[0]);
+      return 2;
+   }
+
+   for (int i = 2; i < argc; i += 2) {
+      if (convert(argv[i], argv[i + 1]) != 0)
+         return 1;
+   }
+
+   out = fopen(argv[1], "wb");
+   if (!out) {
+      perror(argv[1]);
+      return 1;
+   }
+
+   int err = write_le32(out, palette_size);
+   for (unsigned i = 0; i < palette_size && !err; i++)
+      err = write_le32(out, palette[i]);
+
+   if (fclose(out) != 0 || err) {
+      perror(argv[1]);
+      remove(argv[1]);
+      return 1;
+   }
+   return 0;
+}
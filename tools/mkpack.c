@@ -0,0 +1,158 @@
+/* Writes an asset pack for the core (see pack.h for the layout).
+ *
+ * Every argument is a file to store. It is stored under its base name
+ * unless given as name=file, e.g. Left.wav=tone_1k.wav. The pack goes in
+ * the frontend's system directory as avtest.pack; assets it lacks, or
+ * that fail validation, fall back to the ones built into the core.
+ * grid.pal, grid_50.idx8 and grid_60.idx8 only count as a set. gen/mkfont
+ * writes the built-in font as font8x8.bin, to edit and pack.
+ *
+ * Usage: mkpack <out.pack> <[name=]file>...
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../pack.h"
+
+static int write_le32(FILE *out, uint32_t value)
+{
+   for (unsigned i = 0; i < 4; i++) {
+      if (fputc((value >> (8 * i)) & 0xFF, out) == EOF)
+         return -1;
+   }
+   return 0;
+}
+
+static int write_zeros(FILE *out, long count)
+{
+   for (long i = 0; i < count; i++) {
+      if (fputc(0, out) == EOF)
+         return -1;
+   }
+   return 0;
+}
+
+static const char *asset_name(const char *arg)
+{
+   const char *eq = strchr(arg, '=');
+   const char *slash = strrchr(arg, '/');
+
+   if (eq)
+      return arg;
+   return slash ? slash + 1 : arg;
+}
+
+static const char *asset_path(const char *arg)
+{
+   const char *eq = strchr(arg, '=');
+   return eq ? eq + 1 : arg;
+}
+
+static size_t asset_name_len(const char *arg)
+{
+   const char *name = asset_name(arg);
+   const char *eq = strchr(arg, '=');
+   return eq ? (size_t)(eq - name) : strlen(name);
+}
+
+/* Appends one file, padded to PACK_ALIGN, and returns its size */
+static long append_file(FILE *out, const char *path)
+{
+   FILE *in = fopen(path, "rb");
+   char buf[65536];
+   long total = 0;
+   size_t n;
+
+   if (!in) {
+      perror(path);
+      return -1;
+   }
+
+   while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+      if (fwrite(buf, 1, n, out) != n) {
+         fclose(in);
+         return -1;
+      }
+      total += (long)n;
+   }
+
+   if (ferror(in) || total > UINT32_MAX) {
+      fprintf(stderr, "%s: read error or too large\n", path);
+      fclose(in);
+      return -1;
+   }
+
+   fclose(in);
+   if (write_zeros(out, (PACK_ALIGN - total % PACK_ALIGN) % PACK_ALIGN) != 0)
+      return -1;
+   return total;
+}
+
+int main(int argc, char **argv)
+{
+   const unsigned count = argc > 2 ? (unsigned)(argc - 2) : 0;
+   long data_start, offset;
+   FILE *out;
+   int err = 0;
+
+   if (argc < 3) {
+      fprintf(stderr, "Usage: %s <out.pack> <[name=]file>...\n", argv[0]);
+      return 2;
+   }
+
+   for (unsigned i = 0; i < count; i++) {
+      size_t len = asset_name_len(argv[i + 2]);
+      if (len == 0 || len >= PACK_NAME_SIZE) {
+         fprintf(stderr, "%s: asset name must be 1-%d characters\n", argv[i + 2], PACK_NAME_SIZE - 1);
+         return 2;
+      }
+   }
+
+   out = fopen(argv[1], "wb");
+   if (!out) {
+      perror(argv[1]);
+      return 1;
+   }
+
+   /* The index is written once the sizes are known */
+   data_start = PACK_HEADER_SIZE + (long)count * PACK_ENTRY_SIZE;
+   data_start = (data_start + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+   err |= write_zeros(out, data_start);
+
+   offset = data_start;
+   for (unsigned i = 0; i < count && !err; i++) {
+      const char *arg = argv[i + 2];
+      char name[PACK_NAME_SIZE] = {0};
+      long size = append_file(out, asset_path(arg));
+
+      if (size < 0) {
+         err = -1;
+         break;
+      }
+
+      memcpy(name, asset_name(arg), asset_name_len(arg));
+      err |= fseek(out, PACK_HEADER_SIZE + (long)i * PACK_ENTRY_SIZE, SEEK_SET);
+      err |= fwrite(name, 1, PACK_NAME_SIZE, out) == PACK_NAME_SIZE ? 0 : -1;
+      err |= write_le32(out, (uint32_t)offset);
+      err |= write_le32(out, (uint32_t)size);
+      offset += (size + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+      err |= fseek(out, offset, SEEK_SET);
+   }
+
+   if (!err) {
+      err |= fseek(out, 0, SEEK_SET);
+      err |= fwrite(PACK_MAGIC, 1, 8, out) == 8 ? 0 : -1;
+      err |= write_le32(out, count);
+      err |= write_le32(out, 0);
+   }
+
+   if (fclose(out) != 0 || err) {
+      fprintf(stderr, "%s: failed to write pack\n", argv[1]);
+      remove(argv[1]);
+      return 1;
+   }
+   return 0;
+}